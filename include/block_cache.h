@@ -0,0 +1,46 @@
+#pragma once
+
+#include "block_device.h"
+
+// A write-back cache in front of a block device. See `src/block_cache.c`.
+
+// The cache takes this fraction of the ARM memory, e.g. 16 for 1/16th.
+#ifndef BLOCK_CACHE_RAM_DIVISOR
+#define BLOCK_CACHE_RAM_DIVISOR 16
+#endif
+
+// The most blocks that a sequential read fetches beyond what was asked for, and the least once read-ahead kicks in.
+#ifndef BLOCK_CACHE_READ_AHEAD_MAX
+#define BLOCK_CACHE_READ_AHEAD_MAX 256
+#endif
+#ifndef BLOCK_CACHE_READ_AHEAD_MIN
+#define BLOCK_CACHE_READ_AHEAD_MIN 8
+#endif
+
+struct block_cache_stats {
+	u64 hits;
+	u64 misses;
+	// Blocks fetched before they were asked for.
+	u64 read_ahead;
+	// Blocks read ahead that were later asked for.
+	u64 read_ahead_hits;
+	// Dirty blocks written back to the card.
+	u64 write_backs;
+	u64 evictions;
+};
+
+// Call after `malloc_init`, and after the backing device is ready.
+// Anything that accesses `backing` directly afterwards must flush or invalidate the cache as needed.
+bool block_cache_init(struct block_device* backing);
+bool block_cache_read(u8* buffer, u32 block_start, u32 num_blocks);
+// The blocks only reach the card when they are evicted or flushed.
+// If `buffer` is `NULL`, zeros are written instead.
+bool block_cache_write(u8 const* buffer, u32 block_start, u32 num_blocks);
+// Writes all dirty blocks back to the card.
+bool block_cache_flush(void);
+// Drops the cached copies of the blocks without writing them back, e.g. after writing them without the cache.
+void block_cache_invalidate(u32 block_start, u32 num_blocks);
+struct block_cache_stats block_cache_get_stats(void);
+
+// Goes through the cache. Discarding also drops the cached blocks.
+extern struct block_device block_cache_device;
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "emmc_queue.h"
+
+// A device made of fixed-size blocks, such as the SD card, a RAM disk, or a file on the host.
+// Storage code that goes through this rather than calling `emmc_read` and friends directly can be run and benchmarked without an SD card.
+
+enum : u32 {
+	BLOCK_DEVICE_BLOCK_SIZE = 512,
+};
+
+struct block_device;
+
+struct block_request {
+	// Set by the caller.
+	// For writes, it is only read.
+	u8* buffer;
+	u32 block_start;
+	u32 num_blocks;
+	bool write;
+	// Set by the device before the callback is called.
+	bool ok;
+	u8 _pad0[6];
+	// Called once the request finishes. Can be `NULL`.
+	void (*callback)(struct block_request* request);
+	// For use by the callback.
+	void* user;
+	// Private to the device.
+	struct emmc_request emmc;
+};
+
+// Only `read`, `write`, and `capacity` are required; the wrappers below fill in the rest.
+struct block_device_ops {
+	bool (*read)(struct block_device* device, u8* buffer, u32 block_start, u32 num_blocks);
+	// If `buffer` is `NULL`, zeros are written.
+	bool (*write)(struct block_device* device, u8 const* buffer, u32 block_start, u32 num_blocks);
+	// Makes sure that everything written so far has reached the underlying storage.
+	bool (*flush)(struct block_device* device);
+	// Tells the device that the blocks are no longer needed, after which their contents are undefined.
+	bool (*discard)(struct block_device* device, u32 block_start, u32 num_blocks);
+	// In blocks.
+	u32 (*capacity)(struct block_device* device);
+	// Starts the request and returns without waiting for it; the callback is called from `poll`.
+	bool (*submit_async)(struct block_device* device, struct block_request* request);
+	// Makes progress on asynchronous requests without blocking and returns the number that have not finished yet.
+	u32 (*poll)(struct block_device* device);
+	// The unit, in blocks, that writes should be aligned to and cover for the device to be fastest, or 0 if there is none.
+	u32 (*allocation_unit)(struct block_device* device);
+};
+
+struct block_device {
+	struct block_device_ops const* ops;
+	char const* name;
+};
+
+// These check that the blocks are within the device.
+bool block_device_read(struct block_device* device, u8* buffer, u32 block_start, u32 num_blocks);
+bool block_device_write(struct block_device* device, u8 const* buffer, u32 block_start, u32 num_blocks);
+bool block_device_flush(struct block_device* device);
+bool block_device_discard(struct block_device* device, u32 block_start, u32 num_blocks);
+u32 block_device_capacity(struct block_device* device);
+// Devices without `submit_async` do the request synchronously and call the callback before returning.
+// Returns false if the request could not be started, in which case the callback is not called.
+bool block_device_submit_async(struct block_device* device, struct block_request* request);
+u32 block_device_poll(struct block_device* device);
+u32 block_device_allocation_unit(struct block_device* device);
+
+// The SD card. Call `emmc_init` first, and also `emmc_queue_init` before submitting asynchronous requests.
+extern struct block_device block_device_emmc;
+
+// A RAM disk over `memory`, which must be `num_blocks * BLOCK_DEVICE_BLOCK_SIZE` bytes.
+struct block_device_ram {
+	struct block_device device;
+	u8* memory;
+	u32 num_blocks;
+	u8 _pad0[4];
+};
+
+void block_device_ram_init(struct block_device_ram* ram, u8* memory, u32 num_blocks);
+
+// A disk image on the host. Only available in the host build; see `src/host`.
+struct block_device_file {
+	struct block_device device;
+	int fd;
+	u32 num_blocks;
+};
+
+bool block_device_file_open(struct block_device_file* file, char const* path);
+void block_device_file_close(struct block_device_file* file);
@@ -0,0 +1,10 @@
+// Data cache maintenance for memory that is shared with DMA-capable devices.
+// The MMU currently maps RAM as non-cacheable, in which case these are cheap no-ops in effect, but drivers should still call them so they keep working if that changes.
+
+#pragma once
+
+// Writes any dirty lines in the range back to memory, so that a device reading it sees what the CPU wrote.
+void cache_clean(void const* start, usize length);
+// Writes back and then discards the lines in the range, so that the CPU sees what a device wrote.
+// Call this before the device writes, so that no dirty line is evicted over its data, and again afterwards, to drop anything fetched speculatively in the meantime.
+void cache_clean_invalidate(void const* start, usize length);
@@ -0,0 +1,10 @@
+// A text console on the framebuffer.
+// Scrolling would mean copying the whole framebuffer for every line, so instead the output wraps around to the top and the line after the cursor is cleared.
+
+#pragma once
+
+#include "framebuffer.h"
+
+// Must be called after `framebuffer_init`.
+void console_init(void);
+void console_write(char const* text, usize length, framebuffer_color_t color);
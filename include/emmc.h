@@ -2,13 +2,125 @@
 
 enum : u32 {
 	EMMC_BLOCK_SIZE = 512,
+	// The most blocks that a single command, and so an `emmc_start` transfer, can have.
+	EMMC_MAX_TRANSFER_BLOCKS = 65'535,
+	// The most segments that a single `emmc_start` transfer can have.
+	EMMC_MAX_SEGMENTS = 64,
 };
 
+// If enabled, cards that support UHS-I are switched to 1.8 V signaling and run at SDR104 or SDR50 when the controller supports it.
+// Otherwise, the fastest mode is High Speed at 50 MHz.
+#ifndef EMMC_UHS
+#define EMMC_UHS 1
+#endif
+
+// If enabled, multi-block transfers to cards that support it announce their length with CMD23 instead of being stopped with CMD12.
+#ifndef EMMC_AUTO_CMD23
+#define EMMC_AUTO_CMD23 1
+#endif
+
+// If enabled, the driver records when each phase of each command ends and keeps latency statistics per command.
+// Timestamps come from `timer_get_ticks`, which is cheap to read.
+#ifndef EMMC_TRACE
+#define EMMC_TRACE 1
+#endif
+// The number of recent commands whose phases are kept.
+#ifndef EMMC_TRACE_SIZE
+#define EMMC_TRACE_SIZE 128
+#endif
+
 bool emmc_init(void);
 // In blocks.
 u32 emmc_capacity(void);
-// `num_blocks` can be at most 65535.
+// Transfers use DMA if `buffer` is 4-byte aligned and in the first GiB of RAM, and fall back to PIO otherwise.
+// Transfers of more than `EMMC_MAX_TRANSFER_BLOCKS` are split into several commands.
 bool emmc_read(u8* buffer, u32 block_start, u32 num_blocks);
-// `num_blocks` can be at most 65535.
-// If `buffer` is `NULL`, zeros will be written instead.
+// If `buffer` is `NULL`, zeros will be written instead, which is done by erasing if the range is large enough and the card erases to zeros.
 bool emmc_write(u8 const* buffer, u32 block_start, u32 num_blocks);
+// Erases the blocks with CMD38, after which they read as `emmc_erased_byte`.
+// The range is split at allocation unit boundaries so that most of it is erased in whole units.
+bool emmc_erase(u32 block_start, u32 num_blocks);
+// Tells the card that it no longer needs to keep the blocks, after which their contents are undefined.
+// Only whole allocation units in the range are discarded; the rest are left alone.
+bool emmc_discard(u32 block_start, u32 num_blocks);
+// Either 0x00 or 0xff.
+u8 emmc_erased_byte(void);
+// The allocation unit, which is the granularity that the card manages its flash in, in blocks, or 0 if the card doesn't say.
+u32 emmc_allocation_unit(void);
+
+// Whether a transfer with this buffer would use DMA, which is required for `emmc_start`.
+bool emmc_can_dma(void const* buffer, u32 num_blocks);
+
+// A buffer that is part of a transfer. For writes, it is only read.
+struct emmc_segment {
+	u8* buffer;
+	u32 num_blocks;
+	u8 _pad0[4];
+};
+
+typedef enum emmc_status : u32 {
+	emmc_status_idle,
+	emmc_status_busy,
+	emmc_status_done,
+	emmc_status_failed,
+} emmc_status_t;
+
+typedef void (*emmc_completion_handler_t)(void);
+
+// Starts a DMA transfer of consecutive blocks, starting at `block_start`, into or out of the segments in order, and returns without waiting for the data.
+// Every segment must pass `emmc_can_dma`, and there can be at most `EMMC_MAX_TRANSFER_BLOCKS` in total.
+// The segments must stay valid until the transfer finishes, and no other transfer can be started in the meantime.
+// Returns false if the transfer could not be started, in which case there is nothing to finish.
+bool emmc_start(bool write, struct emmc_segment const* segments, u32 segment_count, u32 block_start);
+// Checks on the transfer started by `emmc_start` without waiting.
+// Returns `done` or `failed` once when it finishes (or times out), after which the next transfer can be started.
+emmc_status_t emmc_poll(void);
+// Waits for the transfer started by `emmc_start` to finish. Not to be used together with a completion handler.
+bool emmc_wait(void);
+// The handler is called from the EMMC interrupt when a transfer started by `emmc_start` signals completion, so that it can call `emmc_poll` and start the next one right away.
+// Transfers finish in the handler's context only if IRQs are enabled; otherwise `emmc_poll` must be called to notice them.
+void emmc_set_completion_handler(emmc_completion_handler_t handler);
+
+struct emmc_trace_entry {
+	// In timer ticks.
+	u64 start;
+	// The rest are in microseconds since `start`, or 0 if that phase didn't happen.
+	// When the command was written to the controller.
+	u32 issued;
+	// When the response arrived.
+	u32 response;
+	// When PIO finished moving the data. DMA transfers move their data between `response` and `done`.
+	u32 data;
+	// When the data or busy phase ended, or the command failed.
+	u32 done;
+	u32 arg;
+	u32 blocks;
+	// The error interrupt flags, if the command failed.
+	u32 error;
+	u8 index;
+	bool dma;
+	bool ok;
+	u8 _pad0[1];
+};
+
+enum : u32 {
+	EMMC_TRACE_HISTOGRAM_BUCKETS = 24,
+};
+
+struct emmc_command_stats {
+	u64 total_micros;
+	u32 count;
+	u32 errors;
+	u32 max_micros;
+	// Bucket `i` counts the commands that took less than `2^i` microseconds, except for the last one, which counts all of the slower ones too.
+	u32 histogram[EMMC_TRACE_HISTOGRAM_BUCKETS];
+	u8 _pad0[4];
+};
+
+// Copies up to `capacity` of the most recent trace entries, oldest first, and returns how many were copied.
+u32 emmc_trace_read(struct emmc_trace_entry* out, u32 capacity);
+// For the command with this index. Application commands are counted with the regular command of the same index.
+struct emmc_command_stats emmc_get_command_stats(u8 index);
+void emmc_trace_reset(void);
+// Logs the statistics of every command that has been sent, and the last `entries` (at most 16) trace entries.
+void emmc_trace_dump(u32 entries);
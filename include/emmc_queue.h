@@ -0,0 +1,51 @@
+#pragma once
+
+#include "emmc.h"
+
+// Queues block requests and issues them to the card in the background, sorted by block and with adjacent requests merged into single multi-block transfers.
+// See `src/emmc_queue.c`.
+
+typedef enum emmc_request_state : u32 {
+	emmc_request_pending,
+	emmc_request_in_flight,
+	emmc_request_done,
+	emmc_request_failed,
+} emmc_request_state_t;
+
+struct emmc_request {
+	// Set by the caller.
+	// Must pass `emmc_can_dma`. For writes, it is only read.
+	u8* buffer;
+	u32 block_start;
+	// At most `EMMC_MAX_TRANSFER_BLOCKS`.
+	u32 num_blocks;
+	bool write;
+	// Private to the queue.
+	bool failed;
+	u8 _pad0[2];
+	// Set by the queue.
+	// It only becomes `done` or `failed` once the queue no longer refers to the request, so it can be reused from then on.
+	emmc_request_state_t volatile state;
+	// Called by `emmc_queue_poll` (or `emmc_queue_wait`) after the request finishes. Can be `NULL`.
+	void (*callback)(struct emmc_request* request);
+	// For use by the callback.
+	void* user;
+	// Private to the queue.
+	struct emmc_request* next;
+};
+
+// Registers the completion handler with the EMMC driver. Call it after `emmc_init`.
+// While the queue has requests, `emmc_read` and `emmc_write` must not be used.
+void emmc_queue_init(void);
+// Adds the request to the queue, and starts it if the card is idle.
+// The request must stay valid until it finishes.
+// Requests that overlap are not ordered with respect to each other, so wait for one before submitting the other.
+// Returns false if the request is invalid, in which case it is not queued.
+bool emmc_queue_submit(struct emmc_request* request);
+// Notices finished transfers, starts the next one, and calls the callbacks of finished requests, without blocking.
+// Returns the number of requests that have not finished yet.
+u32 emmc_queue_poll(void);
+// Runs the queue until the request finishes, and returns whether it succeeded.
+bool emmc_queue_wait(struct emmc_request* request);
+// Runs the queue until every request has finished.
+void emmc_queue_drain(void);
@@ -13,8 +13,19 @@ void exception_init(void);
 exception_mask_t exception_get_mask(void);
 void exception_set_mask(exception_mask_t mask);
 
+// Peripheral interrupts that drivers can handle.
+typedef enum exception_irq : u32 {
+	exception_irq_emmc,
+} exception_irq_t;
+
+typedef void (*exception_irq_handler_t)(void);
+
+// Enables the interrupt in the controller and calls `handler` when it fires, or disables it if `handler` is `NULL`.
+// The handler runs with IRQs masked and must clear the interrupt at its source.
+void exception_set_irq_handler(exception_irq_t irq, exception_irq_handler_t handler);
 inline void _without_interrupts_impl(exception_mask_t const* mask) {
-	if (*mask & exception_mask_irq) {
+	// Only unmask if IRQs were unmasked before, so that this can be nested and used in interrupt handlers.
+	if (!(*mask & exception_mask_irq)) {
 		asm volatile("msr daifclr, #0b0010");
 	}
 }
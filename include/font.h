@@ -0,0 +1,15 @@
+// An 8x16 bitmap font covering printable ASCII.
+// The glyphs are generated by `tools/gen-font.py`.
+
+#pragma once
+
+enum : u32 {
+	FONT_WIDTH = 8,
+	FONT_HEIGHT = 16,
+	FONT_FIRST = 0x20,
+	FONT_LAST = 0x7e,
+	FONT_GLYPH_COUNT = FONT_LAST - FONT_FIRST + 1,
+};
+
+// Each row is a byte with the leftmost pixel in the most significant bit.
+extern u8 const FONT_GLYPHS[FONT_GLYPH_COUNT][FONT_HEIGHT];
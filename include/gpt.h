@@ -1,5 +1,7 @@
 #pragma once
 
+#include "block_device.h"
+
 typedef struct __attribute__((packed)) guid {
 	u32 a;
 	u16 b, c;
@@ -16,4 +18,4 @@ struct lba_range {
 	lba_t last;
 };
 
-bool find_partition_by_guid(guid_t const* expected_id, struct lba_range* ret);
+bool find_partition_by_guid(struct block_device* device, guid_t const* expected_id, struct lba_range* ret);
@@ -1,7 +1,7 @@
 #pragma once
 
 // We give them a bit of space so we can add more later if necessary.
-// Make sure to keep this in sync with `rust/src/panic.rs`!
+// Make sure to keep this in sync with `rust/src/panic.rs` and `tools/log-decode.py`!
 
 #define LOG_LEVEL_TRACE 10
 #define LOG_LEVEL_DEBUG 20
@@ -10,13 +10,184 @@
 #define LOG_LEVEL_ERROR 50
 #define LOG_LEVEL_FATAL 60
 
+// Calls below this level are removed at compile-time.
+// Everything at or above it can be enabled at runtime using the per-module thresholds below.
 // Can be set in e.g. Makefile or environment variables.
 #ifndef LOG_LEVEL
-#define LOG_LEVEL LOG_LEVEL_INFO
+#define LOG_LEVEL LOG_LEVEL_TRACE
 #endif
 
+// The threshold that every module starts with.
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_INFO
+#endif
+
+// Records longer than this are truncated.
+#ifndef LOG_RECORD_MAX
+#define LOG_RECORD_MAX 1024
+#endif
+
+// The size of the in-memory ring of recent records, in bytes.
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE (16 * 1024)
+#endif
+
+// Records are queued in a buffer per core and then written to the sinks in timestamp order. See `src/log.c`.
+#ifndef LOG_CORE_COUNT
+#define LOG_CORE_COUNT 4
+#endif
+#ifndef LOG_CORE_BUFFER_SIZE
+#define LOG_CORE_BUFFER_SIZE (16 * 1024)
+#endif
+
+// If enabled, the UART sink sends records as a call site ID followed by binary arguments instead of formatted text.
+// Use `tools/log-decode.py` with the matching `kernel8.elf` to turn the output back into text.
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED 0
+#endif
+
+// If enabled, each record also includes the ID of the core that wrote it.
+#ifndef LOG_CORE_ID
+#define LOG_CORE_ID 0
+#endif
+
+// Each call site may write `LOG_RATE_BURST` records at once and then `LOG_RATE_PER_SECOND` on average; the rest are dropped and counted.
+// Records at `LOG_LEVEL_FATAL` are never dropped.
+#ifndef LOG_RATE_PER_SECOND
+#define LOG_RATE_PER_SECOND 16
+#endif
+#ifndef LOG_RATE_BURST
+#define LOG_RATE_BURST 64
+#endif
+
+// Token bucket state for rate limiting. See `src/log.c`.
+struct log_rate {
+	u64 last_ticks;
+	// In timer ticks, so that refilling doesn't need a division.
+	u64 credit;
+	// Since the last record that was let through.
+	u32 dropped;
+	u32 dropped_total;
+};
+
+// Describes a single `LOG` invocation.
+// Each one is placed in the `.log_sites` section, so its index in that section identifies it in tokenized output.
+// The explicit alignment keeps the compiler from padding the sites apart, which would break the indexing.
+// Make sure to keep the layout in sync with `tools/log-decode.py`!
+struct log_site {
+	char const* file;
+	char const* fmt;
+	u32 line;
+	u32 level;
+	struct log_rate rate;
+};
+
+// Each translation unit that includes this header gets its own module, named after its source file.
+// The threshold can be changed at runtime with `log_set_level`.
+struct log_module {
+	char const* name;
+	u32 level;
+};
+
+static struct log_module _log_module __attribute__((section(".log_modules"), used, aligned(alignof(struct log_module)))) = {
+	.name = __BASE_FILE__,
+	.level = LOG_LEVEL_DEFAULT,
+};
+
+// A single record as passed to sinks.
+struct log_record {
+	u64 ticks;
+	char const* file;
+	u32 line;
+	u32 level;
+	// Only included in the output if `LOG_CORE_ID` is enabled.
+	u8 core;
+	u8 _pad0[7];
+	// The index of the site in `.log_sites` plus one, or zero for `log_write`.
+	u64 site_id;
+	// Only set if a text sink is enabled for this record.
+	// The full line without color or a line ending, e.g. `[    1.234567 info src/main.c:12] hello`.
+	char const* text;
+	usize text_length;
+	// The offset of the message itself in `text`.
+	usize message_offset;
+	// Only set if a tokenized sink is enabled for this record and the arguments fit; see `src/log.c`.
+	u8 const* tokens;
+	usize tokens_length;
+};
+
+struct log_sink {
+	char const* name;
+	void (*write)(struct log_sink* sink, struct log_record const* record);
+	struct log_sink* next;
+	// Records below this level are not passed to this sink, in addition to the module thresholds.
+	u32 level;
+	// Whether this sink uses `tokens` rather than `text`.
+	bool tokens;
+	u8 _pad0[3];
+};
+
+// Writes to the UART, as text or tokens depending on `LOG_TOKENIZED`.
+extern struct log_sink log_sink_uart;
+// Keeps the last `LOG_RING_SIZE` bytes of text in memory, e.g. for dumping after a crash.
+extern struct log_sink log_sink_ring;
+// Writes to the framebuffer console. Register it after `console_init`.
+extern struct log_sink log_sink_console;
+
+// The UART and ring sinks are registered by default.
+// Adding a sink that is already registered does nothing.
+void log_sink_add(struct log_sink* sink);
+struct log_sink* log_sink_find(char const* name, usize name_length);
+// Copies the newest contents of the ring, oldest first, into `out` and returns the length.
+usize log_ring_read(char* out, usize capacity);
+// Writes the contents of the ring to the UART as plain text.
+void log_ring_dump(void);
+
+struct log_stats {
+	// Records dropped by the per-site rate limit.
+	u64 rate_limited;
+	// Records that were identical to the previous one and folded into a "repeated" summary.
+	u64 repeated;
+	// Records dropped because the buffer of the core that wrote them was full.
+	u64 buffer_full;
+};
+
+struct log_stats log_get_stats(void);
+
+// Sets the threshold of the modules matching `module`, which is a source path with the `src/` and `.c` removed, e.g. `emmc` or `devices/lcd`.
+// `*` matches every module.
+// Returns the number of modules that were changed.
+u32 log_set_level(char const* module, u32 level);
+// Runs a control command, one of:
+// - `level <module> <level>`, where `<level>` is a name like `debug` or a number.
+// - `levels`, which lists the modules and their thresholds.
+// - `sink <sink> <level>`, which sets the threshold of a sink.
+// - `sinks`, which lists the sinks and their thresholds.
+// - `dump`, which writes the contents of the ring sink to the UART.
+// - `drops`, which lists the call sites that have been rate limited and the overall counts.
+bool log_control_command(char const* command);
+// Reads any pending control input from the UART without blocking and runs it once a line is complete.
+// Call this periodically from programs that don't otherwise read from the UART.
+void log_control_poll(void);
+
+// For call sites that are not known at compile-time, such as Rust panics.
 void log_write(char const* file, u32 line, u32 level, char const* fmt, ...);
-#define LOG(_level, ...) log_write(__FILE__, __LINE__, _level, ##__VA_ARGS__)
+void log_write_site(struct log_site* site, ...);
+
+// `_fmt` must be a string literal so that it can be stored in the call site.
+// The module threshold is checked before the arguments are evaluated, so disabled calls cost a single load and compare.
+#define LOG(_level, _fmt, ...) \
+	({ \
+		if ((_level) >= _log_module.level) { \
+			static struct log_site _log_site __attribute__((section(".log_sites"), used, aligned(alignof(struct log_site)))) = { \
+				.file = __FILE__, \
+				.fmt = _fmt, \
+				.line = __LINE__, \
+				.level = _level, \
+			}; \
+			log_write_site(&_log_site, ##__VA_ARGS__); \
+		} \
+	})
 
 #if LOG_LEVEL <= LOG_LEVEL_TRACE
 #define LOG_TRACE(...) LOG(LOG_LEVEL_TRACE, ##__VA_ARGS__)
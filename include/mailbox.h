@@ -31,6 +31,8 @@ enum : u32 {
 	MAILBOX_TAG_GET_CLOCK_RATE = 0x3'0002,
 	MAILBOX_TAG_SET_CLOCK_RATE = 0x3'8002,
 
+	MAILBOX_TAG_SET_GPIO_STATE = 0x3'8041,
+
 	MAILBOX_TAG_GET_FRAMEBUFFER = 0x4'0001,
 	MAILBOX_TAG_SET_PHYSICAL_WIDTH_HEIGHT = 0x4'8003,
 	MAILBOX_TAG_SET_VIRTUAL_WIDTH_HEIGHT = 0x4'8004,
@@ -47,3 +49,5 @@ bool mailbox_call(mailbox_channel_t const channel);
 bool mailbox_get_arm_memory(u32* restrict base, u32* restrict size);
 bool mailbox_get_clock_rate(mailbox_clock_t clock, u32* ret);
 bool mailbox_set_clock_rate(mailbox_clock_t clock, u32 rate);
+// For GPIOs that are only accessible to the firmware, such as those on the RPi4's GPIO expander, which are numbered from 128.
+bool mailbox_set_gpio_state(u32 gpio, bool state);
@@ -8,3 +8,7 @@ enum : u64 {
 void sleep_cycles(u64 cycles);
 void sleep_micros(u64 micros);
 void sleep_until(u64 end);
+// Sleeps until any bit of `mask` is set in `*flags`, which must be done by an interrupt handler, or until `end` (as for `sleep_until`).
+// Returns whether a bit was set.
+// If IRQs are masked, this spins instead of sleeping, so the flags must be set some other way.
+bool sleep_until_flag(u32 const volatile* flags, u32 mask, u64 end);
@@ -10,3 +10,20 @@ void timer_acknowledge(u8 timer);
 u64 timer_get_micros(void);
 // Only takes the lower 32 bits so multiple cycles may be necessary to sleep for long periods of time.
 void timer_set_compare(u8 timer, u32 end_micros);
+
+// The ARM generic timer's virtual count.
+// Unlike `timer_get_micros`, this is a system register rather than MMIO, so it is much cheaper to read, and it is synchronized across cores.
+inline u64 timer_get_ticks(void) {
+	u64 ret;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(ret));
+	return ret;
+}
+
+// The frequency of `timer_get_ticks` in hertz, as set up by the armstub.
+inline u64 timer_ticks_per_second(void) {
+	u64 ret;
+	asm("mrs %0, cntfrq_el0" : "=r"(ret));
+	return ret;
+}
+
+u64 timer_ticks_to_micros(u64 ticks);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "block_device.h"
+
+// Coalesces writes into whole allocation units before they reach a block device. See `src/write_stage.c`.
+
+// The most blocks that a staged unit can have. Cards with larger allocation units are staged in aligned pieces of this size.
+// Every allocation unit size that SD cards can report is a multiple of this.
+#ifndef WRITE_STAGE_MAX_BLOCKS
+#define WRITE_STAGE_MAX_BLOCKS 8192
+#endif
+
+// How many units can be staged at once, so that a few interleaved write streams, such as data and metadata, each fill their own.
+#ifndef WRITE_STAGE_UNITS
+#define WRITE_STAGE_UNITS 2
+#endif
+
+struct write_stage_stats {
+	// Blocks copied into staged units.
+	u64 staged_blocks;
+	// Units written out whole once every block had been written.
+	u64 full_units;
+	// Units written out whole after reading the blocks that had not been written.
+	u64 filled_units;
+	// Blocks read to fill them.
+	u64 fill_blocks;
+	// Units that had to be written out while mostly unwritten, so only their written runs were passed on.
+	u64 partial_units;
+	// Whole units that were written without staging.
+	u64 direct_units;
+};
+
+// Call after `malloc_init`, and after the backing device is ready.
+// The unit size comes from `block_device_allocation_unit`.
+bool write_stage_init(struct block_device* backing);
+// Writes out every staged unit.
+bool write_stage_flush(void);
+struct write_stage_stats write_stage_get_stats(void);
+
+// Reads see staged writes. Flushing also flushes the backing device.
+extern struct block_device write_stage_device;
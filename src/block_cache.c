@@ -0,0 +1,395 @@
+// # Approach
+//
+// Each cached block has an entry, which is in a hash table keyed by block number and in an LRU list.
+// There can be hundreds of thousands of entries, so they refer to each other by index rather than by pointer to stay small.
+// Every entry is always in the LRU list; unused ones are kept at the cold end so they are reused first.
+//
+// Dirty blocks are written back when they are evicted or flushed.
+// Either way, we write the whole run of consecutive dirty blocks around them at once, in ascending order, since one multi-block write is much cheaper than many single ones.
+//
+// # Read-Ahead
+//
+// A read that starts where the previous one ended is considered sequential.
+// Each sequential read doubles the read-ahead window, from `BLOCK_CACHE_READ_AHEAD_MIN` up to `BLOCK_CACHE_READ_AHEAD_MAX`, and any other read resets it to zero.
+// When a read misses, the blocks following the request are fetched in the same command, up to the window.
+//
+// Transfers go through staging buffers since the entries of a run are not contiguous in memory.
+
+#include "block_cache.h"
+#include "block_device.h"
+#include "log.h"
+#include "mailbox.h"
+#include "malloc.h"
+#include "string.h"
+#include "try.h"
+
+enum : u32 {
+	NONE = U32_MAX,
+
+	FLAG_VALID = 1 << 0,
+	FLAG_DIRTY = 1 << 1,
+	// Fetched by read-ahead and not asked for yet.
+	FLAG_READ_AHEAD = 1 << 2,
+
+	// Read and write-back runs are split into transfers of at most this many blocks.
+	STAGING_BLOCKS = BLOCK_CACHE_READ_AHEAD_MAX * 2,
+
+	HASH_MULTIPLIER = 0x9e37'79b1,
+};
+
+struct entry {
+	u32 block;
+	u32 flags;
+	u32 lru_prev;
+	u32 lru_next;
+	u32 hash_next;
+};
+
+static struct {
+	struct block_device* backing;
+	struct entry* entries;
+	// `BLOCK_DEVICE_BLOCK_SIZE` bytes for each entry.
+	u8* data;
+	u32* buckets;
+	u8* read_staging;
+	u8* write_staging;
+	u32 count;
+	u32 bucket_bits;
+	// Most recently used.
+	u32 lru_head;
+	u32 lru_tail;
+	// The block after the end of the previous read.
+	u32 sequential_next;
+	u32 read_ahead_window;
+	struct block_cache_stats stats;
+} cache;
+
+static u8* entry_data(u32 const index) {
+	return &cache.data[(usize)index * BLOCK_DEVICE_BLOCK_SIZE];
+}
+
+static u32 bucket_of(u32 const block) {
+	return (block * HASH_MULTIPLIER) >> (32 - cache.bucket_bits);
+}
+
+static u32 lookup(u32 const block) {
+	for (u32 i = cache.buckets[bucket_of(block)]; i != NONE; i = cache.entries[i].hash_next) {
+		if (cache.entries[i].block == block) {
+			return i;
+		}
+	}
+	return NONE;
+}
+
+static void hash_insert(u32 const index) {
+	u32* const bucket = &cache.buckets[bucket_of(cache.entries[index].block)];
+	cache.entries[index].hash_next = *bucket;
+	*bucket = index;
+}
+
+static void hash_remove(u32 const index) {
+	u32* it = &cache.buckets[bucket_of(cache.entries[index].block)];
+	while (*it != index) {
+		it = &cache.entries[*it].hash_next;
+	}
+	*it = cache.entries[index].hash_next;
+}
+
+static void lru_unlink(u32 const index) {
+	struct entry* const entry = &cache.entries[index];
+	if (entry->lru_prev != NONE) {
+		cache.entries[entry->lru_prev].lru_next = entry->lru_next;
+	} else {
+		cache.lru_head = entry->lru_next;
+	}
+	if (entry->lru_next != NONE) {
+		cache.entries[entry->lru_next].lru_prev = entry->lru_prev;
+	} else {
+		cache.lru_tail = entry->lru_prev;
+	}
+}
+
+static void lru_push_head(u32 const index) {
+	struct entry* const entry = &cache.entries[index];
+	entry->lru_prev = NONE;
+	entry->lru_next = cache.lru_head;
+	if (cache.lru_head != NONE) {
+		cache.entries[cache.lru_head].lru_prev = index;
+	} else {
+		cache.lru_tail = index;
+	}
+	cache.lru_head = index;
+}
+
+static void lru_push_tail(u32 const index) {
+	struct entry* const entry = &cache.entries[index];
+	entry->lru_next = NONE;
+	entry->lru_prev = cache.lru_tail;
+	if (cache.lru_tail != NONE) {
+		cache.entries[cache.lru_tail].lru_next = index;
+	} else {
+		cache.lru_head = index;
+	}
+	cache.lru_tail = index;
+}
+
+static void touch(u32 const index) {
+	if (cache.lru_head != index) {
+		lru_unlink(index);
+		lru_push_head(index);
+	}
+}
+
+static bool is_dirty(u32 const index) {
+	return index != NONE && (cache.entries[index].flags & FLAG_DIRTY);
+}
+
+// Writes back the run of dirty blocks that contains the entry.
+static bool write_back_run(u32 const index) {
+	u32 block = cache.entries[index].block;
+	while (block > 0 && is_dirty(lookup(block - 1))) {
+		--block;
+	}
+
+	while (true) {
+		u32 count = 0;
+		while (count < STAGING_BLOCKS) {
+			u32 const dirty = lookup(block + count);
+			if (!is_dirty(dirty)) {
+				break;
+			}
+			memcpy(&cache.write_staging[count * BLOCK_DEVICE_BLOCK_SIZE], entry_data(dirty), BLOCK_DEVICE_BLOCK_SIZE);
+			++count;
+		}
+		if (count == 0) {
+			return true;
+		}
+
+		LOG_TRACE("writing back %u blocks at %u", count, block);
+		TRY_MSG(block_device_write(cache.backing, cache.write_staging, block, count))
+
+		for (u32 i = 0; i < count; ++i) {
+			cache.entries[lookup(block + i)].flags &= ~FLAG_DIRTY;
+		}
+		cache.stats.write_backs += count;
+		block += count;
+	}
+}
+
+// Takes the least recently used entry for the block, writing it back first if necessary.
+// The caller must fill in the data and flags.
+static u32 take_entry(u32 const block) {
+	u32 const index = cache.lru_tail;
+	struct entry* const entry = &cache.entries[index];
+
+	if (entry->flags & FLAG_VALID) {
+		if ((entry->flags & FLAG_DIRTY) && !write_back_run(index)) {
+			return NONE;
+		}
+		hash_remove(index);
+		++cache.stats.evictions;
+	}
+
+	entry->block = block;
+	entry->flags = FLAG_VALID;
+	hash_insert(index);
+	touch(index);
+	return index;
+}
+
+bool block_cache_init(struct block_device* const backing) {
+	u32 base, size;
+	TRY_MSG(mailbox_get_arm_memory(&base, &size))
+
+	u32 const count = size / BLOCK_CACHE_RAM_DIVISOR / (u32)(BLOCK_DEVICE_BLOCK_SIZE + sizeof(struct entry) + sizeof(u32));
+	// A single fill must not evict the blocks it just read.
+	TRY_MSG(count >= STAGING_BLOCKS * 2)
+
+	u32 bucket_bits = 1;
+	while ((1u << bucket_bits) < count) {
+		++bucket_bits;
+	}
+
+	cache.entries = malloc(count * sizeof(struct entry));
+	cache.data = malloc((usize)count * BLOCK_DEVICE_BLOCK_SIZE);
+	cache.buckets = malloc((1u << bucket_bits) * sizeof(u32));
+	cache.read_staging = malloc(STAGING_BLOCKS * BLOCK_DEVICE_BLOCK_SIZE);
+	cache.write_staging = malloc(STAGING_BLOCKS * BLOCK_DEVICE_BLOCK_SIZE);
+	TRY_MSG(cache.entries != NULL && cache.data != NULL && cache.buckets != NULL && cache.read_staging != NULL && cache.write_staging != NULL)
+
+	cache.backing = backing;
+	cache.count = count;
+	cache.bucket_bits = bucket_bits;
+	memset(cache.buckets, 0xff, (1u << bucket_bits) * sizeof(u32));
+	cache.lru_head = NONE;
+	cache.lru_tail = NONE;
+	for (u32 i = 0; i < count; ++i) {
+		cache.entries[i].flags = 0;
+		lru_push_tail(i);
+	}
+
+	LOG_INFO("block cache for %s has %u blocks (%u KiB)", backing->name, count, count / 2);
+	return true;
+}
+
+// Reads the blocks starting at `block`, which is not cached, into the cache.
+// `wanted` of them are being asked for, and the rest are read-ahead.
+static bool fill(u32 const block, u32 const wanted, u32 const read_ahead) {
+	u32 count = 1;
+	u32 const limit = wanted + read_ahead < STAGING_BLOCKS ? wanted + read_ahead : STAGING_BLOCKS;
+	while (count < limit && block + count < block_device_capacity(cache.backing) && lookup(block + count) == NONE) {
+		++count;
+	}
+
+	TRY_MSG(block_device_read(cache.backing, cache.read_staging, block, count))
+
+	for (u32 i = 0; i < count; ++i) {
+		u32 const index = take_entry(block + i);
+		TRY(index != NONE)
+		memcpy(entry_data(index), &cache.read_staging[i * BLOCK_DEVICE_BLOCK_SIZE], BLOCK_DEVICE_BLOCK_SIZE);
+		if (i >= wanted) {
+			cache.entries[index].flags |= FLAG_READ_AHEAD;
+			++cache.stats.read_ahead;
+		}
+	}
+
+	return true;
+}
+
+bool block_cache_read(u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	if (block_start == cache.sequential_next && block_start != 0) {
+		u32 const doubled = cache.read_ahead_window * 2;
+		cache.read_ahead_window = doubled < BLOCK_CACHE_READ_AHEAD_MIN ? BLOCK_CACHE_READ_AHEAD_MIN : doubled > BLOCK_CACHE_READ_AHEAD_MAX ? BLOCK_CACHE_READ_AHEAD_MAX : doubled;
+	} else {
+		cache.read_ahead_window = 0;
+	}
+	cache.sequential_next = block_start + num_blocks;
+
+	for (u32 i = 0; i < num_blocks;) {
+		u32 const block = block_start + i;
+		u32 index = lookup(block);
+		if (index == NONE) {
+			++cache.stats.misses;
+			TRY(fill(block, num_blocks - i, cache.read_ahead_window))
+			index = lookup(block);
+		} else {
+			++cache.stats.hits;
+			if (cache.entries[index].flags & FLAG_READ_AHEAD) {
+				++cache.stats.read_ahead_hits;
+			}
+		}
+
+		cache.entries[index].flags &= ~FLAG_READ_AHEAD;
+		touch(index);
+		memcpy(&buffer[(usize)i * BLOCK_DEVICE_BLOCK_SIZE], entry_data(index), BLOCK_DEVICE_BLOCK_SIZE);
+		++i;
+	}
+
+	return true;
+}
+
+bool block_cache_write(u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	for (u32 i = 0; i < num_blocks; ++i) {
+		u32 const block = block_start + i;
+		u32 index = lookup(block);
+		if (index == NONE) {
+			index = take_entry(block);
+			TRY(index != NONE)
+		} else {
+			touch(index);
+		}
+
+		if (buffer != NULL) {
+			memcpy(entry_data(index), &buffer[(usize)i * BLOCK_DEVICE_BLOCK_SIZE], BLOCK_DEVICE_BLOCK_SIZE);
+		} else {
+			memset(entry_data(index), 0, BLOCK_DEVICE_BLOCK_SIZE);
+		}
+		cache.entries[index].flags = FLAG_VALID | FLAG_DIRTY;
+	}
+
+	return true;
+}
+
+bool block_cache_flush(void) {
+	for (u32 i = 0; i < cache.count; ++i) {
+		if (cache.entries[i].flags & FLAG_DIRTY) {
+			TRY(write_back_run(i))
+		}
+	}
+	return true;
+}
+
+static void invalidate_entry(u32 const index) {
+	hash_remove(index);
+	cache.entries[index].flags = 0;
+	lru_unlink(index);
+	lru_push_tail(index);
+}
+
+void block_cache_invalidate(u32 const block_start, u32 const num_blocks) {
+	if (num_blocks > cache.count) {
+		for (u32 i = 0; i < cache.count; ++i) {
+			struct entry const* const entry = &cache.entries[i];
+			if ((entry->flags & FLAG_VALID) && entry->block - block_start < num_blocks) {
+				invalidate_entry(i);
+			}
+		}
+		return;
+	}
+
+	for (u32 i = 0; i < num_blocks; ++i) {
+		u32 const index = lookup(block_start + i);
+		if (index != NONE) {
+			invalidate_entry(index);
+		}
+	}
+}
+
+struct block_cache_stats block_cache_get_stats(void) {
+	return cache.stats;
+}
+
+static bool device_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return block_cache_read(buffer, block_start, num_blocks);
+}
+
+static bool device_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return block_cache_write(buffer, block_start, num_blocks);
+}
+
+static bool device_flush(struct block_device* const device) {
+	(void)device;
+	return block_cache_flush() && block_device_flush(cache.backing);
+}
+
+static bool device_discard(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	block_cache_invalidate(block_start, num_blocks);
+	return block_device_discard(cache.backing, block_start, num_blocks);
+}
+
+static u32 device_capacity(struct block_device* const device) {
+	(void)device;
+	return block_device_capacity(cache.backing);
+}
+
+static u32 device_allocation_unit(struct block_device* const device) {
+	(void)device;
+	return block_device_allocation_unit(cache.backing);
+}
+
+static struct block_device_ops const OPS = {
+	.read = device_read,
+	.write = device_write,
+	.flush = device_flush,
+	.discard = device_discard,
+	.capacity = device_capacity,
+	.allocation_unit = device_allocation_unit,
+};
+
+struct block_device block_cache_device = {
+	.ops = &OPS,
+	.name = "cache",
+};
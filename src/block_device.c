@@ -0,0 +1,101 @@
+#include "block_device.h"
+#include "log.h"
+#include "string.h"
+#include "try.h"
+
+static bool in_bounds(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	u32 const capacity = device->ops->capacity(device);
+	if (block_start > capacity || num_blocks > capacity - block_start) {
+		LOG_WARN("access to %u blocks at %u is outside of %s, which has %u blocks", num_blocks, block_start, device->name, capacity);
+		return false;
+	}
+	return true;
+}
+
+bool block_device_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	TRY(in_bounds(device, block_start, num_blocks))
+	return device->ops->read(device, buffer, block_start, num_blocks);
+}
+
+bool block_device_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	TRY(in_bounds(device, block_start, num_blocks))
+	return device->ops->write(device, buffer, block_start, num_blocks);
+}
+
+bool block_device_flush(struct block_device* const device) {
+	return device->ops->flush == NULL || device->ops->flush(device);
+}
+
+bool block_device_discard(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	TRY(in_bounds(device, block_start, num_blocks))
+	// Discarding is only a hint, so doing nothing is fine.
+	return device->ops->discard == NULL || device->ops->discard(device, block_start, num_blocks);
+}
+
+u32 block_device_capacity(struct block_device* const device) {
+	return device->ops->capacity(device);
+}
+
+bool block_device_submit_async(struct block_device* const device, struct block_request* const request) {
+	TRY(in_bounds(device, request->block_start, request->num_blocks))
+
+	if (device->ops->submit_async != NULL) {
+		return device->ops->submit_async(device, request);
+	}
+
+	request->ok = request->write ? device->ops->write(device, request->buffer, request->block_start, request->num_blocks) : device->ops->read(device, request->buffer, request->block_start, request->num_blocks);
+	if (request->callback != NULL) {
+		request->callback(request);
+	}
+	return true;
+}
+
+u32 block_device_poll(struct block_device* const device) {
+	return device->ops->poll != NULL ? device->ops->poll(device) : 0;
+}
+
+u32 block_device_allocation_unit(struct block_device* const device) {
+	return device->ops->allocation_unit != NULL ? device->ops->allocation_unit(device) : 0;
+}
+
+static u8* ram_block(struct block_device* const device, u32 const block) {
+	return &((struct block_device_ram*)device)->memory[(usize)block * BLOCK_DEVICE_BLOCK_SIZE];
+}
+
+static bool ram_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	memcpy(buffer, ram_block(device, block_start), (usize)num_blocks * BLOCK_DEVICE_BLOCK_SIZE);
+	return true;
+}
+
+static bool ram_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	if (buffer != NULL) {
+		memcpy(ram_block(device, block_start), buffer, (usize)num_blocks * BLOCK_DEVICE_BLOCK_SIZE);
+	} else {
+		memset(ram_block(device, block_start), 0, (usize)num_blocks * BLOCK_DEVICE_BLOCK_SIZE);
+	}
+	return true;
+}
+
+static bool ram_discard(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	// Zeroing keeps the contents deterministic, which makes tests over RAM disks reproducible.
+	return ram_write(device, NULL, block_start, num_blocks);
+}
+
+static u32 ram_capacity(struct block_device* const device) {
+	return ((struct block_device_ram*)device)->num_blocks;
+}
+
+static struct block_device_ops const RAM_OPS = {
+	.read = ram_read,
+	.write = ram_write,
+	.discard = ram_discard,
+	.capacity = ram_capacity,
+};
+
+void block_device_ram_init(struct block_device_ram* const ram, u8* const memory, u32 const num_blocks) {
+	*ram = (struct block_device_ram){
+		.device = { .ops = &RAM_OPS, .name = "ram" },
+		.memory = memory,
+		.num_blocks = num_blocks,
+	};
+}
@@ -0,0 +1,85 @@
+#include "block_device.h"
+#include "emmc.h"
+#include "emmc_queue.h"
+
+static bool emmc_device_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return emmc_read(buffer, block_start, num_blocks);
+}
+
+static bool emmc_device_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return emmc_write(buffer, block_start, num_blocks);
+}
+
+// Writes are not cached by the card driver, so this only has to wait for queued requests.
+static bool emmc_device_flush(struct block_device* const device) {
+	(void)device;
+	emmc_queue_drain();
+	return true;
+}
+
+static bool emmc_device_discard(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return emmc_discard(block_start, num_blocks);
+}
+
+static u32 emmc_device_capacity(struct block_device* const device) {
+	(void)device;
+	return emmc_capacity();
+}
+
+static void emmc_device_complete(struct emmc_request* const emmc) {
+	struct block_request* const request = emmc->user;
+	request->ok = emmc->state == emmc_request_done;
+	if (request->callback != NULL) {
+		request->callback(request);
+	}
+}
+
+static bool emmc_device_submit_async(struct block_device* const device, struct block_request* const request) {
+	// The queue only does DMA, so anything else is done right away.
+	if (!emmc_can_dma(request->buffer, request->num_blocks) || request->num_blocks > EMMC_MAX_TRANSFER_BLOCKS) {
+		request->ok = request->write ? emmc_device_write(device, request->buffer, request->block_start, request->num_blocks) : emmc_device_read(device, request->buffer, request->block_start, request->num_blocks);
+		if (request->callback != NULL) {
+			request->callback(request);
+		}
+		return true;
+	}
+
+	request->emmc = (struct emmc_request){
+		.buffer = request->buffer,
+		.block_start = request->block_start,
+		.num_blocks = request->num_blocks,
+		.write = request->write,
+		.callback = emmc_device_complete,
+		.user = request,
+	};
+	return emmc_queue_submit(&request->emmc);
+}
+
+static u32 emmc_device_poll(struct block_device* const device) {
+	(void)device;
+	return emmc_queue_poll();
+}
+
+static u32 emmc_device_allocation_unit(struct block_device* const device) {
+	(void)device;
+	return emmc_allocation_unit();
+}
+
+static struct block_device_ops const EMMC_OPS = {
+	.read = emmc_device_read,
+	.write = emmc_device_write,
+	.flush = emmc_device_flush,
+	.discard = emmc_device_discard,
+	.capacity = emmc_device_capacity,
+	.submit_async = emmc_device_submit_async,
+	.poll = emmc_device_poll,
+	.allocation_unit = emmc_device_allocation_unit,
+};
+
+struct block_device block_device_emmc = {
+	.ops = &EMMC_OPS,
+	.name = "emmc",
+};
@@ -0,0 +1,31 @@
+// # References
+//
+// - Arm Architecture Reference Manual for A-profile, sections D7.5.9 (data cache maintenance) and D17.2.34 (CTR_EL0).
+
+#include "cache.h"
+
+// The smallest data cache line size, in bytes.
+static usize line_size(void) {
+	u64 ctr;
+	asm("mrs %0, ctr_el0" : "=r"(ctr));
+	// `DminLine` is the log2 of the number of words.
+	return (usize)4 << ((ctr >> 16) & 0xf);
+}
+
+void cache_clean(void const* const start, usize const length) {
+	usize const line = line_size();
+	usize const end = (usize)start + length;
+	for (usize address = (usize)start & ~(line - 1); address < end; address += line) {
+		asm volatile("dc cvac, %0" ::"r"(address) : "memory");
+	}
+	asm volatile("dsb sy" ::: "memory");
+}
+
+void cache_clean_invalidate(void const* const start, usize const length) {
+	usize const line = line_size();
+	usize const end = (usize)start + length;
+	for (usize address = (usize)start & ~(line - 1); address < end; address += line) {
+		asm volatile("dc civac, %0" ::"r"(address) : "memory");
+	}
+	asm volatile("dsb sy" ::: "memory");
+}
@@ -0,0 +1,75 @@
+#include "console.h"
+#include "font.h"
+
+enum : framebuffer_color_t {
+	BACKGROUND = 0x0000'00ff,
+};
+
+static struct {
+	u32 columns;
+	u32 rows;
+	u32 column;
+	u32 row;
+} console = { 0 };
+
+static void clear_row(u32 const row) {
+	for (u32 y = row * FONT_HEIGHT; y < (row + 1) * FONT_HEIGHT; ++y) {
+		for (u32 x = 0; x < console.columns * FONT_WIDTH; ++x) {
+			framebuffer_draw_pixel(x, y, BACKGROUND);
+		}
+	}
+}
+
+static void newline(void) {
+	console.column = 0;
+	console.row = (console.row + 1) % console.rows;
+	clear_row(console.row);
+}
+
+static void draw_glyph(char ch, framebuffer_color_t const color) {
+	if (ch < (char)FONT_FIRST || ch > (char)FONT_LAST) {
+		ch = '?';
+	}
+	u8 const* const glyph = FONT_GLYPHS[(u8)ch - FONT_FIRST];
+	u32 const base_x = console.column * FONT_WIDTH;
+	u32 const base_y = console.row * FONT_HEIGHT;
+	for (u32 y = 0; y < FONT_HEIGHT; ++y) {
+		for (u32 x = 0; x < FONT_WIDTH; ++x) {
+			bool const set = glyph[y] & (0x80 >> x);
+			framebuffer_draw_pixel(base_x + x, base_y + y, set ? color : BACKGROUND);
+		}
+	}
+}
+
+void console_init(void) {
+	console.columns = framebuffer_width() / FONT_WIDTH;
+	console.rows = framebuffer_height() / FONT_HEIGHT;
+	console.column = 0;
+	console.row = 0;
+	framebuffer_fill(BACKGROUND);
+}
+
+void console_write(char const* const text, usize const length, framebuffer_color_t const color) {
+	// Not initialized, or the framebuffer is not available.
+	if (console.columns == 0 || console.rows == 0) {
+		return;
+	}
+
+	for (usize i = 0; i < length; ++i) {
+		switch (text[i]) {
+			case '\n':
+				newline();
+				break;
+			case '\r':
+				console.column = 0;
+				break;
+			default:
+				if (console.column == console.columns) {
+					newline();
+				}
+				draw_glyph(text[i], color);
+				++console.column;
+				break;
+		}
+	}
+}
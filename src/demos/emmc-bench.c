@@ -0,0 +1,231 @@
+// Measures the SD card: sequential throughput across transfer sizes, and random 4 KiB IOPS across queue depths, with latency percentiles for each.
+//
+// The benchmark overwrites the partition whose unique GUID is `BENCH_PARTITION`, so create a dedicated one and set the GUID below.
+// If `APPEND_RESULTS` is enabled, the results are also appended as text to the last `RESULTS_BLOCKS` blocks of the partition, so that runs with different drivers or cards can be compared later.
+
+#include "block_device.h"
+#include "emmc.h"
+#include "emmc_queue.h"
+#include "gpt.h"
+#include "malloc.h"
+#include "printf.h"
+#include "random.h"
+#include "string.h"
+#include "timer.h"
+#include "try.h"
+#include "uart.h"
+
+#define APPEND_RESULTS 1
+
+// Set this to the unique GUID of the partition to use, e.g. as shown by `sgdisk -i`.
+static guid_t const BENCH_PARTITION = { 0x0000'0000, 0x0000, 0x0000, { 0x00, 0x00 }, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } };
+
+enum : u32 {
+	// Each sequential test transfers this many bytes.
+	SEQUENTIAL_BYTES = 32 * 1'024 * 1'024,
+	RANDOM_BLOCKS = 4'096 / EMMC_BLOCK_SIZE,
+	RANDOM_REQUESTS = 2'000,
+	MAX_QUEUE_DEPTH = 32,
+	RESULTS_BLOCKS = 2'048,
+	MAX_SAMPLES = SEQUENTIAL_BYTES / 4'096 > RANDOM_REQUESTS ? SEQUENTIAL_BYTES / 4'096 : RANDOM_REQUESTS,
+};
+
+static u32 const SEQUENTIAL_SIZES[] = { 8, 128, 2'048, 16'384 };
+static u32 const QUEUE_DEPTHS[] = { 1, 4, 16, 32 };
+
+static struct {
+	// Where the benchmark may write, as opposed to where the results go.
+	u32 scratch_start;
+	u32 scratch_blocks;
+	u32 results_start;
+	u32 sample_count;
+	// In microseconds.
+	u32 samples[MAX_SAMPLES];
+	char report[16 * 1'024];
+	usize report_length;
+} bench;
+
+static void report_write(void* const user, char const ch) {
+	(void)user;
+	if (bench.report_length < sizeof(bench.report)) {
+		bench.report[bench.report_length++] = ch;
+	}
+}
+
+// Prints to the UART and keeps a copy for appending to the partition.
+static void report(char const* const fmt, ...) {
+	__builtin_va_list args;
+	__builtin_va_start(args, fmt);
+	uart_vprintf(fmt, args);
+	__builtin_va_end(args);
+
+	__builtin_va_start(args, fmt);
+	vdprintf(report_write, NULL, fmt, args);
+	__builtin_va_end(args);
+}
+
+static void sort_samples(void) {
+	// Shell sort with Ciura's gaps is plenty for a few thousand samples.
+	static u32 const GAPS[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+	for (usize g = 0; g < sizeof(GAPS) / sizeof(GAPS[0]); ++g) {
+		u32 const gap = GAPS[g];
+		for (u32 i = gap; i < bench.sample_count; ++i) {
+			u32 const value = bench.samples[i];
+			u32 j = i;
+			for (; j >= gap && bench.samples[j - gap] > value; j -= gap) {
+				bench.samples[j] = bench.samples[j - gap];
+			}
+			bench.samples[j] = value;
+		}
+	}
+}
+
+static u32 percentile(u32 const per_mille) {
+	return bench.samples[(u64)(bench.sample_count - 1) * per_mille / 1'000];
+}
+
+static void record(u64 const micros) {
+	if (bench.sample_count < MAX_SAMPLES) {
+		bench.samples[bench.sample_count++] = (u32)micros;
+	}
+}
+
+static void report_result(char const* const test, u32 const size_blocks, u32 const queue_depth, u64 const blocks, u64 const micros) {
+	sort_samples();
+	u64 const kib_per_second = blocks * EMMC_BLOCK_SIZE * 1'000'000 / 1'024 / (micros > 0 ? micros : 1);
+	u64 const iops = (u64)bench.sample_count * 1'000'000 / (micros > 0 ? micros : 1);
+	report(
+		"%-10s %6u KiB qd %2u: %6llu.%03llu MiB/s %7llu IOPS, latency us p50 %u p90 %u p99 %u p99.9 %u max %u\r\n",
+		test,
+		size_blocks / 2,
+		queue_depth,
+		kib_per_second / 1'024,
+		kib_per_second % 1'024 * 1'000 / 1'024,
+		iops,
+		percentile(500),
+		percentile(900),
+		percentile(990),
+		percentile(999),
+		bench.samples[bench.sample_count - 1]);
+}
+
+static void sequential(bool const write, u32 const size_blocks, u8* const buffer) {
+	bench.sample_count = 0;
+	u32 const total_blocks = SEQUENTIAL_BYTES / EMMC_BLOCK_SIZE;
+
+	u64 const start = timer_get_micros();
+	for (u32 block = 0; block < total_blocks; block += size_blocks) {
+		u64 const request_start = timer_get_micros();
+		u32 const target = bench.scratch_start + block;
+		assert(write ? emmc_write(buffer, target, size_blocks) : emmc_read(buffer, target, size_blocks), "sequential transfer");
+		record(timer_get_micros() - request_start);
+	}
+
+	report_result(write ? "seq write" : "seq read", size_blocks, 1, total_blocks, timer_get_micros() - start);
+}
+
+static struct {
+	struct emmc_request requests[MAX_QUEUE_DEPTH];
+	u64 submitted[MAX_QUEUE_DEPTH];
+	u8 buffers[MAX_QUEUE_DEPTH][RANDOM_BLOCKS * EMMC_BLOCK_SIZE] __attribute__((aligned(64)));
+	u32 remaining;
+	bool write;
+	u8 _pad0[3];
+} random_state;
+
+static void random_submit(struct emmc_request* const request) {
+	usize const slot = (usize)(request - random_state.requests);
+	--random_state.remaining;
+	*request = (struct emmc_request){
+		.buffer = random_state.buffers[slot],
+		.block_start = bench.scratch_start + random() % (bench.scratch_blocks / RANDOM_BLOCKS) * RANDOM_BLOCKS,
+		.num_blocks = RANDOM_BLOCKS,
+		.write = random_state.write,
+		.callback = request->callback,
+	};
+	random_state.submitted[slot] = timer_get_micros();
+	assert(emmc_queue_submit(request), "submitting random request");
+}
+
+static void random_complete(struct emmc_request* const request) {
+	usize const slot = (usize)(request - random_state.requests);
+	record(timer_get_micros() - random_state.submitted[slot]);
+	assert(request->state == emmc_request_done, "random transfer");
+	if (random_state.remaining > 0) {
+		random_submit(request);
+	}
+}
+
+static void random_io(bool const write, u32 const queue_depth) {
+	bench.sample_count = 0;
+	random_state.remaining = RANDOM_REQUESTS;
+	random_state.write = write;
+
+	u64 const start = timer_get_micros();
+	for (u32 i = 0; i < queue_depth; ++i) {
+		random_state.requests[i].callback = random_complete;
+		random_submit(&random_state.requests[i]);
+	}
+	emmc_queue_drain();
+
+	report_result(write ? "rand write" : "rand read", RANDOM_BLOCKS, queue_depth, (u64)RANDOM_REQUESTS * RANDOM_BLOCKS, timer_get_micros() - start);
+}
+
+// The results area is filled from the start, and unused blocks begin with a zero or erased byte.
+static void append_results(void) {
+	u8 block[EMMC_BLOCK_SIZE];
+	u32 offset = 0;
+	for (; offset < RESULTS_BLOCKS; ++offset) {
+		assert(emmc_read(block, bench.results_start + offset, 1), "reading results");
+		if (block[0] == 0 || block[0] == 0xff) {
+			break;
+		}
+	}
+
+	u32 const report_blocks = (u32)((bench.report_length + EMMC_BLOCK_SIZE - 1) / EMMC_BLOCK_SIZE);
+	if (offset + report_blocks > RESULTS_BLOCKS) {
+		uart_printf("results area is full, not appending\r\n");
+		return;
+	}
+
+	// Pad with zeros, which also marks the end for the next run.
+	memset(&bench.report[bench.report_length], 0, report_blocks * EMMC_BLOCK_SIZE - bench.report_length);
+	assert(emmc_write((u8 const*)bench.report, bench.results_start + offset, report_blocks), "writing results");
+	uart_printf("appended %u blocks of results at block %u\r\n", report_blocks, bench.results_start + offset);
+}
+
+void main(void) {
+	assert(emmc_init(), "initializing EMMC");
+	emmc_queue_init();
+
+	struct lba_range range;
+	assert(find_partition_by_guid(&block_device_emmc, &BENCH_PARTITION, &range), "finding the benchmark partition");
+	assert(range.last < U32_MAX && range.last - range.first + 1 > RESULTS_BLOCKS + SEQUENTIAL_BYTES / EMMC_BLOCK_SIZE, "benchmark partition is too small");
+	bench.scratch_start = (u32)range.first;
+	bench.results_start = (u32)range.last + 1 - RESULTS_BLOCKS;
+	bench.scratch_blocks = bench.results_start - bench.scratch_start;
+
+	u8* const buffer = malloc(SEQUENTIAL_SIZES[sizeof(SEQUENTIAL_SIZES) / sizeof(SEQUENTIAL_SIZES[0]) - 1] * EMMC_BLOCK_SIZE);
+	assert(buffer != NULL && emmc_can_dma(buffer, 1), "allocating the transfer buffer");
+	for (u32 i = 0; i < SEQUENTIAL_SIZES[0] * EMMC_BLOCK_SIZE; ++i) {
+		buffer[i] = (u8)random();
+	}
+
+	report("emmc benchmark over blocks %u..%u, allocation unit %u blocks\r\n", bench.scratch_start, bench.results_start, emmc_allocation_unit());
+
+	for (usize i = 0; i < sizeof(SEQUENTIAL_SIZES) / sizeof(SEQUENTIAL_SIZES[0]); ++i) {
+		sequential(true, SEQUENTIAL_SIZES[i], buffer);
+		sequential(false, SEQUENTIAL_SIZES[i], buffer);
+	}
+
+	for (usize i = 0; i < sizeof(QUEUE_DEPTHS) / sizeof(QUEUE_DEPTHS[0]); ++i) {
+		random_io(true, QUEUE_DEPTHS[i]);
+		random_io(false, QUEUE_DEPTHS[i]);
+	}
+
+	if (APPEND_RESULTS) {
+		append_results();
+	}
+
+	emmc_trace_dump(0);
+}
@@ -4,13 +4,18 @@
 // - <https://www.raspberrypi.org/app/uploads/2012/02/BCM2835-ARM-Peripherals.pdf> (for RPi3 but the EMMC controller is the same except for the base address)
 // - <https://web.archive.org/web/20170107083932/http://lib.store.yahoo.net/lib/yhst-92940736592539/ts4gsdhc150.pdf>
 // - <https://web.archive.org/web/20160301223058/http://www.circlemud.org/jelson/sdcard/SDCardStandardv1.9.pdf>
+// - SD Host Controller Simplified Specification, version 3.00 (the EMMC2 controller on the RPi4 is SDHCI-compatible, including ADMA2)
 
 #include "base.h"
+#include "cache.h"
 #include "emmc.h"
+#include "exception.h"
 #include "gpio.h"
 #include "log.h"
 #include "mailbox.h"
 #include "sleep.h"
+#include "string.h"
+#include "timer.h"
 #include "try.h"
 
 /*
@@ -64,6 +69,12 @@ static struct {
 	// Each bit specifies whether the setting of that given "interrupt flag" bit will generate an actual hardware interrupt.
 	u32 interrupt_enable;
 	u32 control2;
+	u32 capabilities[2];
+	u32 _res0[3];
+	// The state of the ADMA engine when an ADMA error occurred.
+	u32 adma_error;
+	// The bus address of the first ADMA2 descriptor.
+	u32 adma_address;
 	// There are more registers but none of them are necessary for this driver.
 } volatile* const EMMC = (void volatile*)(PERIPHERAL_BASE + 0x34'0000);
 
@@ -81,7 +92,11 @@ enum : u32 {
 	SD_CLOCK_100 = 100'000'000,
 	SD_CLOCK_208 = 208'000'000,
 
+	CTRL0_DATA_WIDTH_4 = 1 << 1,
+	CTRL0_HIGH_SPEED = 1 << 2,
 	CTRL0_RPI4_ENABLE_BUS_POWER = 0xf00,
+	CTRL0_DMA_SELECT_MASK = 0b11 << 3,
+	CTRL0_DMA_SELECT_ADMA2_32 = 0b10 << 3,
 
 	CTRL1_CLOCK_DIVIDER_MASK = 0xffe0,
 	DIVISOR_MAX = (1 << 10) - 1,
@@ -97,8 +112,28 @@ enum : u32 {
 
 	CTRL1_RESET_ALL = CTRL1_RESET_DATA | CTRL1_RESET_COMMAND | CTRL1_RESET_HOST,
 
+	// These are in the upper half of `control2`, which is host control 2.
+	CTRL2_UHS_MODE_SHIFT = 16,
+	CTRL2_UHS_MODE_MASK = 0b111 << CTRL2_UHS_MODE_SHIFT,
+	CTRL2_SIGNAL_1V8 = 1 << 19,
+	CTRL2_EXECUTE_TUNING = 1 << 22,
+	CTRL2_SAMPLING_CLOCK_TUNED = 1 << 23,
+
+	UHS_MODE_SDR25 = 1,
+	UHS_MODE_SDR50 = 2,
+	UHS_MODE_SDR104 = 3,
+
+	// In `capabilities[1]`.
+	CAPABILITIES1_SDR50 = 1 << 0,
+	CAPABILITIES1_SDR104 = 1 << 1,
+
+	// The regulator for the SD card's I/O voltage is on the GPIO expander. Setting it selects 1.8 V.
+	GPIO_SD_IO_1V8 = 128 + 4,
+
 	STATUS_COMMAND_INHIBIT = 1 << 0,
 	STATUS_DATA_INHIBIT = 1 << 1,
+	// The levels of DAT0 through DAT3.
+	STATUS_DATA_LINES_MASK = 0b1111 << 20,
 
 	CARD_STATUS_READY_FOR_DATA = 1 << 8,
 	CARD_STATUS_CURRENT_STATE_SHIFT = 9,
@@ -113,14 +148,76 @@ enum : u32 {
 	INTERRUPT_DATA_ERROR = 1 << 15,
 	INTERRUPT_COMMAND_TIMEOUT = 1 << 16,
 	INTERRUPT_DATA_TIMEOUT = 1 << 20,
+	INTERRUPT_ADMA_ERROR = 1 << 25,
 	INTERRUPT_ERROR_MASK = 0xffff'0000,
+	// These are signaled to the CPU and collected by `handle_interrupt`.
+	INTERRUPTS_SIGNALED = INTERRUPT_COMMAND_DONE | INTERRUPT_DATA_DONE | INTERRUPT_WRITE_READY | INTERRUPT_READ_READY | INTERRUPT_ERROR_MASK,
 
 	OCR_VOLTAGE_WINDOW = 0x00ff'8000,
+	// Sent by the host to request, and by the card to accept, switching to 1.8 V signaling.
+	OCR_SWITCH_1V8 = 1 << 24,
 	OCR_SDHC_SUPPORT = 1 << 30,
 	OCR_DONE = 1u << 31,
 
 	RCA_MASK = 0xffff'0000,
 
+	// The SCR is sent most significant byte first, so these are indices into the bytes as received.
+	SCR_SIZE = 8,
+	SCR_SPEC_BYTE = 0,
+	SCR_SPEC_MASK = 0xf,
+	// CMD6 was added in version 1.10 of the physical layer specification.
+	SCR_SPEC_1_10 = 1,
+	SCR_BUS_WIDTHS_BYTE = 1,
+	SCR_BUS_WIDTH_4 = 1 << 2,
+	// If set, erased blocks read as all ones rather than all zeros.
+	SCR_ERASED_ONES_BYTE = 1,
+	SCR_ERASED_ONES = 1 << 7,
+	SCR_COMMANDS_BYTE = 3,
+	SCR_COMMAND_SET_BLOCK_COUNT = 1 << 1,
+
+	// The SD status, read with ACMD13, is also sent most significant byte first.
+	SD_STATUS_SIZE = 64,
+	// The high nibble is the allocation unit size; see `AU_BLOCKS`.
+	SD_STATUS_AU_SIZE_BYTE = 10,
+	SD_STATUS_AU_SIZE_SHIFT = 4,
+	// Two bytes, big-endian.
+	SD_STATUS_ERASE_SIZE_BYTE = 11,
+	// The high 6 bits are the timeout and the low 2 bits are the offset.
+	SD_STATUS_ERASE_TIMEOUT_BYTE = 13,
+	SD_STATUS_ERASE_TIMEOUT_SHIFT = 2,
+	SD_STATUS_ERASE_OFFSET_MASK = 0b11,
+	SD_STATUS_DISCARD_BYTE = 24,
+	SD_STATUS_DISCARD = 1 << 1,
+
+	// The argument of CMD38.
+	ERASE_ERASE = 0,
+	ERASE_DISCARD = 1,
+	// If the card doesn't specify its erase timing, we erase this many blocks per command and allow this long for each, in milliseconds.
+	ERASE_FALLBACK_BLOCKS = 8'192,
+	ERASE_FALLBACK_TIMEOUT = 10'000,
+
+	// The argument of ACMD6.
+	BUS_WIDTH_4 = 0b10,
+
+	// The argument of CMD6: whether to switch or just check, and a 4-bit function for each of the six groups.
+	// We only use group 1, the access mode; 0xf means no change for the others.
+	SWITCH_MODE_SET = 1u << 31,
+	SWITCH_OTHER_GROUPS_UNCHANGED = 0x00ff'fff0,
+	SWITCH_STATUS_SIZE = 64,
+	// The status is sent most significant byte first, so these are indices into the bytes as received.
+	// This contains the low 8 bits of the functions supported in group 1.
+	SWITCH_STATUS_SUPPORT_BYTE = 13,
+	// The low nibble is the function that group 1 was (or would be) switched to.
+	SWITCH_STATUS_RESULT_BYTE = 16,
+
+	ACCESS_MODE_HIGH_SPEED = 1,
+	ACCESS_MODE_SDR50 = 2,
+	ACCESS_MODE_SDR104 = 3,
+
+	TUNING_BLOCK_SIZE = 64,
+	// The specification limits tuning to 40 attempts.
+	TUNING_ATTEMPTS = 40,
+
 	CONDITION_VOLTAGE_SHIFT = 8,
 	CONDITION_3_3V = 1,
 	// A dummy byte that is simply echoed back by the card.
@@ -129,12 +226,16 @@ enum : u32 {
 	CONDITION = CONDITION_3_3V << CONDITION_VOLTAGE_SHIFT | CONDITION_ECHO,
 	CONDITION_MASK = 0xfff,
 
+	CMD_DMA = 1 << 0,
 	CMD_BLOCK_COUNTER = 1 << 1,
 	// Unset = host to card.
 	CMD_CARD_TO_HOST = 1 << 4,
 	CMD_MULTIBLOCK = 1 << 5,
 	CMD_IS_DATA = 1 << 21,
+	CMD_AUTO_MASK = 0b11 << 2,
 	CMD_AUTO_12 = 0b01 << 2,
+	// The controller sends CMD23 with the block count from `arg2` before the command.
+	CMD_AUTO_23 = 0b10 << 2,
 
 	CMD_SHIFT_RESPONSE_TYPE = 16,
 	CMD_SHIFT_CRC = 19,
@@ -144,6 +245,36 @@ enum : u32 {
 	CMD_MASK_RESPONSE_TYPE = (1 << 2) - 1,
 };
 
+// ADMA2 descriptors are 32-bit: attributes, length, and a 32-bit bus address.
+// See section 1.13 of the SD host controller specification.
+struct adma_descriptor {
+	u16 attributes;
+	// Zero means 65536 bytes.
+	u16 length;
+	u32 address;
+};
+
+enum : u32 {
+	ADMA_VALID = 1 << 0,
+	ADMA_END = 1 << 1,
+	ADMA_INTERRUPT = 1 << 2,
+	ADMA_ACTION_TRANSFER = 0b10 << 4,
+	ADMA_ACTION_LINK = 0b11 << 4,
+
+	ADMA_MAX_LENGTH = 1 << 16,
+	// Enough for the largest single command plus one more for each segment boundary.
+	ADMA_DESCRIPTORS = (EMMC_MAX_TRANSFER_BLOCKS * EMMC_BLOCK_SIZE + ADMA_MAX_LENGTH - 1) / ADMA_MAX_LENGTH + EMMC_MAX_SEGMENTS,
+	// ADMA2 requires 32-bit alignment of data addresses and lengths.
+	ADMA_ALIGNMENT = 4,
+
+	// The EMMC2 controller sees the first GiB of RAM at this bus address.
+	DMA_BUS_BASE = 0xc000'0000,
+	DMA_BUS_LIMIT = 0x4000'0000,
+
+	// We expect DMA transfers to run at least this fast (in bytes per millisecond) when computing timeouts.
+	DMA_MIN_RATE = 256,
+};
+
 #define MAKE_EMMC_COMMAND(_response_type, _crc_enable, _index) \
 	(((_response_type) << CMD_SHIFT_RESPONSE_TYPE) | ((_crc_enable) << CMD_SHIFT_CRC) | ((_index) << CMD_SHIFT_INDEX))
 
@@ -153,15 +284,25 @@ enum emmc_command : u32 {
 	command_send_relative_address = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 3),
 	command_io_set_operating_conditions = MAKE_EMMC_COMMAND(RESPONSE_136, 0, 5),
 	command_select_card = MAKE_EMMC_COMMAND(RESPONSE_48_BUSY, 1, 7),
+	// An application command, so it must be preceded by `command_application_prefix`.
+	command_set_bus_width = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 6),
+	command_switch_function = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 6) | CMD_CARD_TO_HOST | CMD_IS_DATA,
 	command_send_if_condition = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 8),
+	command_voltage_switch = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 11),
 	command_get_card_specific_data = MAKE_EMMC_COMMAND(RESPONSE_136, 1, 9),
 	command_set_block_length = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 16),
+	command_send_tuning_block = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 19) | CMD_CARD_TO_HOST | CMD_IS_DATA,
 	command_read_block = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 17) | CMD_CARD_TO_HOST | CMD_IS_DATA,
 	command_read_multiple = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 18) | CMD_BLOCK_COUNTER | CMD_AUTO_12 | CMD_CARD_TO_HOST | CMD_MULTIBLOCK | CMD_IS_DATA,
 	command_write_block = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 24) | CMD_IS_DATA,
 	command_write_multiple = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 25) | CMD_BLOCK_COUNTER | CMD_AUTO_12 | CMD_MULTIBLOCK | CMD_IS_DATA,
 	command_check_ocr = MAKE_EMMC_COMMAND(RESPONSE_48, 0, 41),
 	command_send_scr = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 51) | CMD_CARD_TO_HOST | CMD_IS_DATA,
+	// An application command.
+	command_send_sd_status = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 13) | CMD_CARD_TO_HOST | CMD_IS_DATA,
+	command_erase_start = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 32),
+	command_erase_end = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 33),
+	command_erase = MAKE_EMMC_COMMAND(RESPONSE_48_BUSY, 1, 38),
 	command_application_prefix = MAKE_EMMC_COMMAND(RESPONSE_48, 1, 55),
 };
 
@@ -171,16 +312,61 @@ static struct {
 		u32 const* write;
 	} buffer;
 	u32 transfer_blocks;
+	// Only changed for reads of registers that are smaller than a block, like the SCR.
+	u32 transfer_block_size;
+	// Whether a DMA transfer has been started and not yet finished by `finish_transfer`.
+	bool volatile transfer_active;
+	// Whether to call `completion_handler` when the active transfer finishes, which is only done for `emmc_start`.
+	bool transfer_notify;
+	bool transfer_write;
+	u8 _pad1[5];
+	// The segments of the active transfer, which are needed again for cache maintenance once it finishes.
+	struct emmc_segment const* transfer_segments;
+	u32 transfer_segment_count;
+	// Collected by `handle_interrupt` until they are consumed by `wait_interrupt`.
+	u32 volatile interrupt_flags;
+	u64 transfer_deadline;
 	u32 last_response[4];
 	u32 relative_card_address;
 	u32 base_clock;
+	// The actual SD clock rate, which may be lower than what was requested.
+	u32 clock_rate;
 	u32 last_error;
 	// In blocks.
 	u32 capacity;
+	// The SD configuration register, which describes the features the card supports.
+	u8 scr[SCR_SIZE];
 	// High-capacity cards use block-based addressing, while normal-capacity cards use byte-based addressing, so we need to keep track of what kind our card is.
 	bool high_capacity;
+	// Whether the card accepted switching to 1.8 V signaling, which is required for the UHS-I modes.
+	bool signal_1v8;
+	// Whether multi-block transfers are preceded by CMD23 instead of being stopped by CMD12.
+	bool set_block_count;
+	// Whether the card supports discarding, as opposed to erasing, blocks.
+	bool discard;
+	// From the SD status. The time to erase `erase_au_count` allocation units is `erase_timeout_secs`, plus `erase_offset_secs` per command.
+	u16 erase_au_count;
+	u8 erase_timeout_secs;
+	u8 erase_offset_secs;
+	// The allocation unit in blocks, or 0 if the card doesn't say.
+	u32 au_blocks;
+} device = { .transfer_block_size = EMMC_BLOCK_SIZE };
+
+static struct adma_descriptor adma_descriptors[ADMA_DESCRIPTORS] __attribute__((aligned(ADMA_ALIGNMENT)));
+
+static emmc_completion_handler_t completion_handler = NULL;
+
+// See `EMMC_TRACE`.
+static struct {
+	struct emmc_trace_entry ring[EMMC_TRACE_SIZE];
+	// Indexed by command index.
+	struct emmc_command_stats commands[CMD_MASK_INDEX + 1];
+	// The number of entries ever started. The latest is at `(count - 1) % EMMC_TRACE_SIZE`.
+	u32 count;
+	// Whether the latest entry is for a command that is still running.
+	bool open;
 	u8 _pad0[3];
-} device = { 0 };
+} trace;
 
 static bool wait_reg_mask(u32 volatile* const reg, u32 const mask, bool const wanted_value, u32 const timeout_millis) {
 	u32 const timeout_micros = timeout_millis * 1'000;
@@ -195,10 +381,58 @@ static bool wait_reg_mask(u32 volatile* const reg, u32 const mask, bool const wa
 	return false;
 }
 
-static u32 get_clock_divider(u32 const base_clock, u32 const target_rate) {
-	assert(base_clock % target_rate == 0, "base clock not a multiple of target rate");
-	u32 const divisor = base_clock / target_rate;
-	assert(divisor <= DIVISOR_MAX, "divisor is too large, will not fit");
+static void handle_interrupt(void) {
+	// Acknowledge them here, otherwise the interrupt would fire again immediately.
+	u32 const flags = EMMC->interrupt_flags & (INTERRUPTS_SIGNALED | INTERRUPT_DATA_ERROR);
+	EMMC->interrupt_flags = flags;
+	device.interrupt_flags |= flags;
+
+	if (device.transfer_active && device.transfer_notify && completion_handler != NULL && (flags & (INTERRUPT_DATA_DONE | INTERRUPT_DATA_ERROR))) {
+		completion_handler();
+	}
+}
+
+// Waits until any of `mask` or an error is flagged, and returns the flags in `mask` as well as any errors.
+// Only the flags in `ack` are consumed; errors are left for a later stage to report unless they are included.
+// Returns 0 on timeout.
+//
+// If IRQs are enabled, this sleeps until `handle_interrupt` collects the flags; otherwise it polls the register.
+static u32 wait_interrupt(u32 const mask, u32 ack, u32 const timeout_millis) {
+	u32 const wanted = mask | INTERRUPT_DATA_ERROR;
+	u64 const end = timer_get_micros() + (u64)timeout_millis * 1'000;
+	if (!(exception_get_mask() & exception_mask_irq)) {
+		sleep_until_flag(&device.interrupt_flags, wanted, end);
+	} else {
+		while (!((device.interrupt_flags | EMMC->interrupt_flags) & wanted) && timer_get_micros() < end) {
+			sleep_micros(1);
+		}
+	}
+
+	// The error summary bit stays set until all of the errors are acknowledged.
+	if (ack & INTERRUPT_ERROR_MASK) {
+		ack |= INTERRUPT_DATA_ERROR;
+	}
+
+	u32 flags;
+	WITHOUT_INTERRUPTS({
+		flags = device.interrupt_flags | EMMC->interrupt_flags;
+		EMMC->interrupt_flags = flags & ack;
+		device.interrupt_flags &= ~(flags & ack);
+	})
+	return flags & (mask | INTERRUPT_ERROR_MASK);
+}
+
+// The SD clock is `base_clock / (2 * divisor)`, or `base_clock` itself if the divisor is 0.
+// We pick the fastest rate that does not exceed `target_rate`, since the card must not be clocked faster than its mode allows.
+static u32 get_clock_divider(u32 const base_clock, u32 const target_rate, u32* const actual_rate) {
+	u32 divisor = 0;
+	*actual_rate = base_clock;
+	if (target_rate < base_clock) {
+		divisor = (base_clock + 2 * target_rate - 1) / (2 * target_rate);
+		assert(divisor <= DIVISOR_MAX, "divisor is too large, will not fit");
+		*actual_rate = base_clock / (2 * divisor);
+	}
+
 	u32 const lsb8 = divisor & 0xff;
 	u32 const msb2 = (divisor >> 8) & 0b11;
 	return (lsb8 << 8) | (msb2 << 6);
@@ -208,7 +442,8 @@ static bool switch_clock_rate(u32 const base_clock, u32 const target_rate) {
 	LOG_TRACE("switching clock rate to %u with base clock %u", target_rate, base_clock);
 
 	// Get divider here so we fail early if we cannot find one.
-	u32 const divider = get_clock_divider(base_clock, target_rate);
+	u32 actual_rate;
+	u32 const divider = get_clock_divider(base_clock, target_rate, &actual_rate);
 
 	wait_reg_mask(&EMMC->status, STATUS_COMMAND_INHIBIT | STATUS_DATA_INHIBIT, false, 1'000);
 
@@ -224,7 +459,8 @@ static bool switch_clock_rate(u32 const base_clock, u32 const target_rate) {
 	c1 |= CTRL1_CLOCK_ENABLE;
 	EMMC->control[1] = c1;
 
-	LOG_TRACE("switched clock rate to %u", target_rate);
+	device.clock_rate = actual_rate;
+	LOG_DEBUG("switched clock rate to %u (requested %u)", actual_rate, target_rate);
 
 	return true;
 }
@@ -241,7 +477,7 @@ static bool emmc_setup_clock(void) {
 	c1 |= CTRL1_CLOCK_ENABLE_INTERNAL;
 
 	c1 &= ~CTRL1_CLOCK_DIVIDER_MASK;
-	c1 |= get_clock_divider(device.base_clock, SD_CLOCK_ID);
+	c1 |= get_clock_divider(device.base_clock, SD_CLOCK_ID, &device.clock_rate);
 
 	c1 &= ~CTRL1_DATA_TIMEOUT_MASK;
 	c1 |= 11u << CTRL1_DATA_TIMEOUT_SHIFT;
@@ -276,10 +512,7 @@ static bool do_data_transfer(emmc_marshaled_command_t const command) {
 	}
 
 	for (u32 block = 0; block < device.transfer_blocks; ++block) {
-		wait_reg_mask(&EMMC->interrupt_flags, rw_interrupt_flag | INTERRUPT_DATA_ERROR, true, TIMEOUT_DEFAULT);
-
-		u32 const interrupt_flags = EMMC->interrupt_flags & (INTERRUPT_ERROR_MASK | rw_interrupt_flag);
-		EMMC->interrupt_flags = rw_interrupt_flag | INTERRUPT_DATA_ERROR;
+		u32 const interrupt_flags = wait_interrupt(rw_interrupt_flag, rw_interrupt_flag, TIMEOUT_DEFAULT);
 
 		if (interrupt_flags != rw_interrupt_flag) {
 			set_last_error(interrupt_flags);
@@ -290,16 +523,16 @@ static bool do_data_transfer(emmc_marshaled_command_t const command) {
 		// This collapses 128/256 branches to 1 in an incredibly hot loop.
 		if (write) {
 			if (device.buffer.write != NULL) {
-				for (u32 i = 0; i < EMMC_BLOCK_SIZE; i += sizeof(EMMC->data)) {
+				for (u32 i = 0; i < device.transfer_block_size; i += sizeof(EMMC->data)) {
 					EMMC->data = *device.buffer.write++;
 				}
 			} else {
-				for (u32 i = 0; i < EMMC_BLOCK_SIZE; i += sizeof(EMMC->data)) {
+				for (u32 i = 0; i < device.transfer_block_size; i += sizeof(EMMC->data)) {
 					EMMC->data = 0;
 				}
 			}
 		} else {
-			for (u32 i = 0; i < EMMC_BLOCK_SIZE; i += sizeof(EMMC->data)) {
+			for (u32 i = 0; i < device.transfer_block_size; i += sizeof(EMMC->data)) {
 				*device.buffer.read++ = EMMC->data;
 			}
 		}
@@ -308,29 +541,95 @@ static bool do_data_transfer(emmc_marshaled_command_t const command) {
 	return true;
 }
 
-static bool emmc_command(emmc_marshaled_command_t const command, u32 const arg, u32 const timeout) {
+static struct emmc_trace_entry* trace_latest(void) {
+	return &trace.ring[(trace.count - 1) % EMMC_TRACE_SIZE];
+}
+
+static u32 trace_elapsed(void) {
+	return (u32)timer_ticks_to_micros(timer_get_ticks() - trace_latest()->start);
+}
+
+static void trace_begin(emmc_marshaled_command_t const command, u32 const arg) {
+	if (!EMMC_TRACE) {
+		return;
+	}
+
+	++trace.count;
+	*trace_latest() = (struct emmc_trace_entry){
+		.start = timer_get_ticks(),
+		.arg = arg,
+		.blocks = (command & CMD_IS_DATA) ? device.transfer_blocks : 0,
+		.index = (u8)((command >> CMD_SHIFT_INDEX) & CMD_MASK_INDEX),
+		.dma = command & CMD_DMA,
+	};
+	trace.open = true;
+}
+
+// Records the time since the start of the current command in one of its phase fields.
+#define TRACE_PHASE(_field) \
+	({ \
+		if (EMMC_TRACE && trace.open) { \
+			trace_latest()->_field = trace_elapsed(); \
+		} \
+	})
+
+static void trace_end(bool const ok) {
+	if (!EMMC_TRACE || !trace.open) {
+		return;
+	}
+	trace.open = false;
+
+	struct emmc_trace_entry* const entry = trace_latest();
+	entry->done = trace_elapsed();
+	entry->ok = ok;
+	entry->error = ok ? 0 : device.last_error;
+
+	struct emmc_command_stats* const stats = &trace.commands[entry->index];
+	++stats->count;
+	stats->errors += !ok;
+	stats->total_micros += entry->done;
+	if (entry->done > stats->max_micros) {
+		stats->max_micros = entry->done;
+	}
+	u32 bucket = 0;
+	while (bucket < EMMC_TRACE_HISTOGRAM_BUCKETS - 1 && entry->done >= (1u << bucket)) {
+		++bucket;
+	}
+	++stats->histogram[bucket];
+}
+
+// Sends the command and waits for its response, but not for any data or busy phase that follows; see `command_finish`.
+static bool command_start(emmc_marshaled_command_t const command, u32 const arg, u32 const timeout) {
 	LOG_DEBUG("sending EMMC command %x with arg %u and timeout %u", command, arg, timeout);
 
-	TRY_MSG(device.transfer_blocks < (1 << 16))
+	TRY_MSG(device.transfer_blocks <= EMMC_MAX_TRANSFER_BLOCKS)
 
 	device.last_error = 0;
+	trace_begin(command, arg);
 
-	EMMC->block_size_count = EMMC_BLOCK_SIZE | (device.transfer_blocks << 16);
+	if ((command & CMD_AUTO_MASK) == CMD_AUTO_23) {
+		EMMC->arg2 = device.transfer_blocks;
+	}
+	EMMC->block_size_count = device.transfer_block_size | (device.transfer_blocks << 16);
 	EMMC->arg1 = arg;
 	EMMC->command = command;
+	TRACE_PHASE(issued);
 
 	LOG_TRACE("waiting for \"command done\" interrupt flag");
 
-	TRY_MSG(wait_reg_mask(&EMMC->interrupt_flags, INTERRUPT_DATA_ERROR | INTERRUPT_COMMAND_DONE, true, timeout))
-
-	u32 interrupt_flags = EMMC->interrupt_flags;
-
-	EMMC->interrupt_flags = INTERRUPT_ERROR_MASK | INTERRUPT_COMMAND_DONE;
+	u32 interrupt_flags = wait_interrupt(INTERRUPT_COMMAND_DONE, INTERRUPT_ERROR_MASK | INTERRUPT_COMMAND_DONE, timeout);
+	if (interrupt_flags == 0) {
+		LOG_WARN("timed out waiting for command %x", command);
+		trace_end(false);
+		return false;
+	}
 
-	if ((interrupt_flags & (INTERRUPT_ERROR_MASK | INTERRUPT_COMMAND_DONE)) != INTERRUPT_COMMAND_DONE) {
+	if (interrupt_flags != INTERRUPT_COMMAND_DONE) {
 		set_last_error(interrupt_flags);
+		trace_end(false);
 		return false;
 	}
+	TRACE_PHASE(response);
 
 	LOG_TRACE("copying response");
 
@@ -349,28 +648,47 @@ static bool emmc_command(emmc_marshaled_command_t const command, u32 const arg,
 			break;
 	}
 
+	return true;
+}
+
+// Waits for the "data done" flag that ends the data or busy phase of a command.
+static bool wait_data_done(u32 const timeout) {
+	LOG_TRACE("waiting for \"data done\" interrupt flag");
+
+	u32 const interrupt_flags = wait_interrupt(INTERRUPT_DATA_DONE, INTERRUPT_ERROR_MASK | INTERRUPT_DATA_DONE, timeout);
+
+	if ((interrupt_flags & ~INTERRUPT_DATA_TIMEOUT) != INTERRUPT_DATA_DONE) {
+		if (interrupt_flags & INTERRUPT_ADMA_ERROR) {
+			LOG_ERROR("ADMA error, state %x at descriptor %x", EMMC->adma_error, EMMC->adma_address);
+		}
+		set_last_error(interrupt_flags);
+		return false;
+	}
+
+	return true;
+}
+
+// Completes the data or busy phase, if any, of a command sent by `command_start`.
+// DMA transfers are completed by `finish_transfer` instead.
+static bool command_finish(emmc_marshaled_command_t const command) {
+	u32 const response_type = (command >> CMD_SHIFT_RESPONSE_TYPE) & CMD_MASK_RESPONSE_TYPE;
 	bool const is_data = command & CMD_IS_DATA;
 	if (is_data) {
 		do_data_transfer(command);
+		TRACE_PHASE(data);
 	}
 
+	bool ret = true;
 	if (response_type == RESPONSE_48_BUSY || is_data) {
-		LOG_TRACE("waiting for \"data done\" interrupt flag");
-
-		wait_reg_mask(&EMMC->interrupt_flags, INTERRUPT_DATA_ERROR | INTERRUPT_DATA_DONE, true, TIMEOUT_DEFAULT);
-		interrupt_flags = EMMC->interrupt_flags & (INTERRUPT_ERROR_MASK | INTERRUPT_DATA_DONE);
-
-		EMMC->interrupt_flags = INTERRUPT_ERROR_MASK | INTERRUPT_DATA_DONE;
-
-		if ((interrupt_flags & ~INTERRUPT_DATA_TIMEOUT) != INTERRUPT_DATA_DONE) {
-			set_last_error(interrupt_flags);
-			return false;
-		}
-
-		EMMC->interrupt_flags = INTERRUPT_ERROR_MASK | INTERRUPT_DATA_DONE;
+		ret = wait_data_done(TIMEOUT_DEFAULT);
 	}
 
-	return true;
+	trace_end(ret);
+	return ret;
+}
+
+static bool emmc_command(emmc_marshaled_command_t const command, u32 const arg, u32 const timeout) {
+	return command_start(command, arg, timeout) && command_finish(command);
 }
 
 static bool reset_command(void) {
@@ -418,16 +736,21 @@ static bool check_usable_card(void) {
 	}
 }
 
+static bool host_supports_uhs(void) {
+	return EMMC_UHS && (EMMC->capabilities[1] & (CAPABILITIES1_SDR50 | CAPABILITIES1_SDR104));
+}
+
 static bool check_sdhc_support(bool const v2_card) {
 	LOG_DEBUG("checking for SDHC support");
 
 	while (true) {
-		u32 const v2_flags = v2_card ? OCR_SDHC_SUPPORT : 0;
+		u32 const v2_flags = v2_card ? OCR_SDHC_SUPPORT | (host_supports_uhs() ? OCR_SWITCH_1V8 : 0) : 0;
 
 		TRY_MSG(emmc_app_command(command_check_ocr, OCR_VOLTAGE_WINDOW | v2_flags, TIMEOUT_DEFAULT))
 
 		if (device.last_response[0] & OCR_DONE) {
 			device.high_capacity = device.last_response[0] & OCR_SDHC_SUPPORT;
+			device.signal_1v8 = (v2_flags & OCR_SWITCH_1V8) && (device.last_response[0] & OCR_SWITCH_1V8);
 			return true;
 		}
 
@@ -496,6 +819,200 @@ static bool check_card_specific_data(void) {
 	return true;
 }
 
+// Reads a single block of `size` bytes, which is smaller than `EMMC_BLOCK_SIZE`, using PIO.
+static bool read_small_block(emmc_marshaled_command_t const command, u32 const arg, bool const app, u32* const out, u32 const size) {
+	device.buffer.read = out;
+	device.transfer_blocks = 1;
+	device.transfer_block_size = size;
+
+	bool const ret = app ? emmc_app_command(command, arg, TIMEOUT_DEFAULT) : emmc_command(command, arg, TIMEOUT_DEFAULT);
+
+	device.transfer_blocks = 0;
+	device.transfer_block_size = EMMC_BLOCK_SIZE;
+	return ret;
+}
+
+static bool read_scr(void) {
+	LOG_DEBUG("reading SCR");
+
+	u32 scr[SCR_SIZE / sizeof(u32)];
+	TRY_MSG(read_small_block(command_send_scr, 0, true, scr, sizeof(scr)))
+
+	memcpy(device.scr, scr, sizeof(device.scr));
+	LOG_DEBUG("SCR is %@d", device.scr, sizeof(device.scr));
+
+	device.set_block_count = EMMC_AUTO_CMD23 && (device.scr[SCR_COMMANDS_BYTE] & SCR_COMMAND_SET_BLOCK_COUNT);
+	LOG_DEBUG("card %s CMD23", device.set_block_count ? "supports" : "does not support");
+
+	return true;
+}
+
+// The card starts out using only DAT0. Switching to all four data lines roughly quadruples the transfer rate.
+static bool set_bus_width(void) {
+	if (!(device.scr[SCR_BUS_WIDTHS_BYTE] & SCR_BUS_WIDTH_4)) {
+		LOG_INFO("card does not support a 4-bit bus, staying at 1 bit");
+		return true;
+	}
+
+	TRY_MSG(emmc_app_command(command_set_bus_width, BUS_WIDTH_4, TIMEOUT_DEFAULT))
+	EMMC->control[0] |= CTRL0_DATA_WIDTH_4;
+
+	LOG_DEBUG("switched to 4-bit bus");
+
+	return true;
+}
+
+// Indexed by the AU_SIZE field of the SD status.
+static u32 const AU_BLOCKS[16] = { 0, 32, 64, 128, 256, 512, 1'024, 2'048, 4'096, 8'192, 16'384, 24'576, 32'768, 49'152, 65'536, 131'072 };
+
+// The SD status tells us the allocation unit, which is the granularity that the card manages its flash in, and how long erasing takes.
+static bool read_sd_status(void) {
+	LOG_DEBUG("reading SD status");
+
+	u32 status_words[SD_STATUS_SIZE / sizeof(u32)];
+	TRY_MSG(read_small_block(command_send_sd_status, 0, true, status_words, sizeof(status_words)))
+	u8 const* const status = (u8 const*)status_words;
+
+	device.au_blocks = AU_BLOCKS[status[SD_STATUS_AU_SIZE_BYTE] >> SD_STATUS_AU_SIZE_SHIFT];
+	device.erase_au_count = (u16)(status[SD_STATUS_ERASE_SIZE_BYTE] << 8 | status[SD_STATUS_ERASE_SIZE_BYTE + 1]);
+	device.erase_timeout_secs = status[SD_STATUS_ERASE_TIMEOUT_BYTE] >> SD_STATUS_ERASE_TIMEOUT_SHIFT;
+	device.erase_offset_secs = status[SD_STATUS_ERASE_TIMEOUT_BYTE] & SD_STATUS_ERASE_OFFSET_MASK;
+	device.discard = status[SD_STATUS_DISCARD_BYTE] & SD_STATUS_DISCARD;
+
+	LOG_DEBUG("allocation unit is %u blocks, erasing %u of them takes %u+%u s, discard %@b", device.au_blocks, device.erase_au_count, device.erase_timeout_secs, device.erase_offset_secs, device.discard);
+
+	return true;
+}
+
+// The sequence from section 3.6.1 of the host controller specification.
+// This must happen right after ACMD41, and if it fails the card needs to be power-cycled.
+static bool switch_signal_voltage(void) {
+	LOG_DEBUG("switching to 1.8 V signaling");
+
+	TRY_MSG(emmc_command(command_voltage_switch, 0, TIMEOUT_DEFAULT))
+
+	EMMC->control[1] &= ~CTRL1_CLOCK_ENABLE;
+
+	// The card drives the data lines low until it has switched.
+	TRY_MSG(!(EMMC->status & STATUS_DATA_LINES_MASK))
+
+	TRY_MSG(mailbox_set_gpio_state(GPIO_SD_IO_1V8, true))
+	EMMC->control2 |= CTRL2_SIGNAL_1V8;
+	sleep_micros(5'000);
+	TRY_MSG(EMMC->control2 & CTRL2_SIGNAL_1V8)
+
+	EMMC->control[1] |= CTRL1_CLOCK_ENABLE;
+	sleep_micros(1'000);
+
+	// The card releases the data lines once it is ready.
+	TRY_MSG((EMMC->status & STATUS_DATA_LINES_MASK) == STATUS_DATA_LINES_MASK)
+
+	LOG_DEBUG("switched to 1.8 V signaling");
+
+	return true;
+}
+
+// `status` receives the 64-byte switch status.
+static bool switch_function(bool const set, u32 const access_mode, u8* const status) {
+	u32 raw[SWITCH_STATUS_SIZE / sizeof(u32)];
+	u32 const arg = (set ? SWITCH_MODE_SET : 0) | SWITCH_OTHER_GROUPS_UNCHANGED | access_mode;
+	TRY_MSG(read_small_block(command_switch_function, arg, false, raw, sizeof(raw)))
+	memcpy(status, raw, sizeof(raw));
+	return true;
+}
+
+static bool switch_access_mode(u32 const access_mode) {
+	u8 status[SWITCH_STATUS_SIZE];
+	TRY_MSG(switch_function(true, access_mode, status))
+	if ((status[SWITCH_STATUS_RESULT_BYTE] & 0xf) != access_mode) {
+		LOG_WARN("card did not switch to access mode %u", access_mode);
+		return false;
+	}
+	return true;
+}
+
+// Sends the tuning block pattern repeatedly while the controller adjusts its sampling point.
+// The controller consumes the data itself, so we only wait for each block to arrive.
+static bool execute_tuning(void) {
+	LOG_DEBUG("tuning sampling clock");
+
+	EMMC->control2 |= CTRL2_EXECUTE_TUNING;
+
+	for (u32 attempt = 0; attempt < TUNING_ATTEMPTS && (EMMC->control2 & CTRL2_EXECUTE_TUNING); ++attempt) {
+		EMMC->block_size_count = TUNING_BLOCK_SIZE | (1 << 16);
+		EMMC->arg1 = 0;
+		EMMC->command = command_send_tuning_block;
+
+		u32 const interrupt_flags = wait_interrupt(INTERRUPT_READ_READY, INTERRUPTS_SIGNALED, 150);
+		if (interrupt_flags != INTERRUPT_READ_READY) {
+			LOG_DEBUG("tuning block %u failed with flags %x", attempt, interrupt_flags);
+			EMMC->control[1] |= CTRL1_RESET_COMMAND | CTRL1_RESET_DATA;
+			wait_reg_mask(&EMMC->control[1], CTRL1_RESET_COMMAND | CTRL1_RESET_DATA, false, TIMEOUT_DEFAULT);
+		}
+	}
+
+	u32 const control2 = EMMC->control2;
+	if ((control2 & CTRL2_EXECUTE_TUNING) || !(control2 & CTRL2_SAMPLING_CLOCK_TUNED)) {
+		LOG_WARN("tuning failed");
+		EMMC->control2 = control2 & ~(CTRL2_EXECUTE_TUNING | CTRL2_SAMPLING_CLOCK_TUNED);
+		return false;
+	}
+
+	LOG_DEBUG("tuning succeeded");
+
+	return true;
+}
+
+static bool set_uhs_mode(u32 const access_mode, u32 const uhs_mode, u32 const clock) {
+	TRY(switch_access_mode(access_mode))
+
+	EMMC->control[1] &= ~CTRL1_CLOCK_ENABLE;
+	EMMC->control2 = (EMMC->control2 & ~CTRL2_UHS_MODE_MASK) | (uhs_mode << CTRL2_UHS_MODE_SHIFT);
+	EMMC->control[0] |= CTRL0_HIGH_SPEED;
+	switch_clock_rate(device.base_clock, clock);
+
+	return execute_tuning();
+}
+
+// Picks the fastest mode that both the card and the controller support.
+// Must be called after switching to a 4-bit bus, which the UHS-I modes require.
+static bool select_bus_speed(void) {
+	if ((device.scr[SCR_SPEC_BYTE] & SCR_SPEC_MASK) < SCR_SPEC_1_10) {
+		LOG_INFO("card does not support CMD6, staying at default speed");
+		return switch_clock_rate(device.base_clock, SD_CLOCK_NORMAL);
+	}
+
+	u8 status[SWITCH_STATUS_SIZE];
+	TRY_MSG(switch_function(false, 0xf, status))
+	u8 const supported = status[SWITCH_STATUS_SUPPORT_BYTE];
+	LOG_DEBUG("card supports access modes %b", supported);
+
+	if (device.signal_1v8) {
+		u32 const capabilities = EMMC->capabilities[1];
+		if ((supported & (1 << ACCESS_MODE_SDR104)) && (capabilities & CAPABILITIES1_SDR104) && set_uhs_mode(ACCESS_MODE_SDR104, UHS_MODE_SDR104, SD_CLOCK_208)) {
+			LOG_INFO("using SDR104 at %u Hz", device.clock_rate);
+			return true;
+		}
+		if ((supported & (1 << ACCESS_MODE_SDR50)) && (capabilities & CAPABILITIES1_SDR50) && set_uhs_mode(ACCESS_MODE_SDR50, UHS_MODE_SDR50, SD_CLOCK_100)) {
+			LOG_INFO("using SDR50 at %u Hz", device.clock_rate);
+			return true;
+		}
+		// At 1.8 V, the high speed access mode is SDR25.
+		switch_clock_rate(device.base_clock, SD_CLOCK_NORMAL);
+		EMMC->control2 = (EMMC->control2 & ~CTRL2_UHS_MODE_MASK) | (UHS_MODE_SDR25 << CTRL2_UHS_MODE_SHIFT);
+	}
+
+	if ((supported & (1 << ACCESS_MODE_HIGH_SPEED)) && switch_access_mode(ACCESS_MODE_HIGH_SPEED)) {
+		EMMC->control[0] |= CTRL0_HIGH_SPEED;
+		switch_clock_rate(device.base_clock, SD_CLOCK_HIGH);
+		LOG_INFO("using high speed at %u Hz", device.clock_rate);
+		return true;
+	}
+
+	LOG_INFO("using default speed");
+	return switch_clock_rate(device.base_clock, SD_CLOCK_NORMAL);
+}
+
 static bool emmc_card_reset(void) {
 	LOG_DEBUG("resetting card");
 
@@ -507,9 +1024,10 @@ static bool emmc_card_reset(void) {
 
 	TRY_MSG(emmc_setup_clock())
 
-	EMMC->interrupt_enable = 0;
 	EMMC->interrupt_flags = 0xffffffff;
 	EMMC->interrupt_mask = 0xffffffff;
+	device.interrupt_flags = 0;
+	EMMC->interrupt_enable = INTERRUPTS_SIGNALED;
 
 	device.transfer_blocks = 0;
 
@@ -523,6 +1041,10 @@ static bool emmc_card_reset(void) {
 
 	TRY_MSG(check_sdhc_support(v2_card))
 
+	if (device.signal_1v8) {
+		TRY_MSG(switch_signal_voltage())
+	}
+
 	switch_clock_rate(device.base_clock, SD_CLOCK_NORMAL);
 
 	TRY_MSG(check_rca())
@@ -535,32 +1057,289 @@ static bool emmc_card_reset(void) {
 		TRY_MSG(emmc_command(command_set_block_length, EMMC_BLOCK_SIZE, TIMEOUT_DEFAULT))
 	}
 
+	TRY_MSG(read_scr())
+
+	TRY_MSG(set_bus_width())
+
+	// Only erasing depends on this, and it can cope without.
+	if (!read_sd_status()) {
+		LOG_WARN("could not read SD status, erasing will be slower");
+	}
+
+	TRY_MSG(select_bus_speed())
+
 	// Acknowledge any leftover interrupts, just to be safe.
-	EMMC->interrupt_flags = 0xffffffff;
+	WITHOUT_INTERRUPTS({
+		EMMC->interrupt_flags = 0xffffffff;
+		device.interrupt_flags = 0;
+	})
 
 	return true;
 }
 
-static bool do_data_command(bool const write, union read_or_write const buffer, u32 const num_blocks, u32 block_start) {
+static bool can_use_dma(void const* const buffer, u32 const num_blocks) {
+	usize const address = (usize)buffer;
+	// Writing zeros uses PIO since there is no buffer to point the descriptors at.
+	return buffer != NULL && address % ADMA_ALIGNMENT == 0 && address + (usize)num_blocks * EMMC_BLOCK_SIZE <= DMA_BUS_LIMIT;
+}
+
+bool emmc_can_dma(void const* const buffer, u32 const num_blocks) {
+	return can_use_dma(buffer, num_blocks);
+}
+
+// Fills in the descriptor table so that the segments are transferred back to back, and does the cache maintenance for them.
+static void prepare_dma(bool const write, struct emmc_segment const* const segments, u32 const segment_count) {
+	usize i = 0;
+	for (u32 segment = 0; segment < segment_count; ++segment) {
+		usize length = (usize)segments[segment].num_blocks * EMMC_BLOCK_SIZE;
+		u32 address = DMA_BUS_BASE | (u32)(usize)segments[segment].buffer;
+
+		// Make sure the device doesn't see stale data, and that the CPU doesn't evict dirty lines over what the device writes.
+		if (write) {
+			cache_clean(segments[segment].buffer, length);
+		} else {
+			cache_clean_invalidate(segments[segment].buffer, length);
+		}
+
+		while (length > 0) {
+			usize const chunk = length < ADMA_MAX_LENGTH ? length : ADMA_MAX_LENGTH;
+			length -= chunk;
+			adma_descriptors[i] = (struct adma_descriptor){
+				.attributes = (u16)(ADMA_VALID | ADMA_ACTION_TRANSFER),
+				.length = (u16)chunk,
+				.address = address,
+			};
+			address += (u32)chunk;
+			++i;
+		}
+	}
+	adma_descriptors[i - 1].attributes |= ADMA_END;
+	cache_clean(adma_descriptors, i * sizeof(adma_descriptors[0]));
+
+	EMMC->adma_address = DMA_BUS_BASE | (u32)(usize)adma_descriptors;
+	EMMC->control[0] = (EMMC->control[0] & ~CTRL0_DMA_SELECT_MASK) | CTRL0_DMA_SELECT_ADMA2_32;
+}
+
+static u32 block_address(u32 const block) {
+	// Normal-capacity cards are addressed in bytes.
+	return device.high_capacity ? block : block * EMMC_BLOCK_SIZE;
+}
+
+static u32 data_command(bool const write, u32 const num_blocks) {
+	static u32 const COMMANDS[2][2] = {
+		{ command_read_block, command_read_multiple },
+		{ command_write_block, command_write_multiple },
+	};
+	u32 command = COMMANDS[write][num_blocks > 1];
+	if (num_blocks > 1 && device.set_block_count) {
+		// The card knows where the transfer ends, so there is no need to stop it with CMD12.
+		command = (command & ~CMD_AUTO_MASK) | CMD_AUTO_23;
+	}
+	return command;
+}
+
+// Undoes `prepare_dma` once the engine has stopped.
+static void end_dma(bool const ok) {
+	if (!device.transfer_write) {
+		// Drop any lines that were speculatively fetched during the transfer.
+		for (u32 i = 0; i < device.transfer_segment_count; ++i) {
+			cache_clean_invalidate(device.transfer_segments[i].buffer, (usize)device.transfer_segments[i].num_blocks * EMMC_BLOCK_SIZE);
+		}
+	}
+
+	if (!ok) {
+		// The DMA engine may have stopped in the middle of the transfer.
+		EMMC->control[1] |= CTRL1_RESET_DATA;
+		wait_reg_mask(&EMMC->control[1], CTRL1_RESET_DATA, false, TIMEOUT_DEFAULT);
+	}
+}
+
+// Ends the active transfer, which must have signaled "data done" or an error, or timed out.
+static bool finish_transfer(void) {
+	bool const ret = wait_data_done(0);
+	trace_end(ret);
+	end_dma(ret);
+	device.transfer_active = false;
+	return ret;
+}
+
+static bool start_transfer(bool const write, struct emmc_segment const* const segments, u32 const segment_count, u32 const block_start, bool const notify) {
+	TRY_MSG(!device.transfer_active)
+	TRY_MSG(segment_count > 0 && segment_count <= EMMC_MAX_SEGMENTS)
+
+	u32 num_blocks = 0;
+	for (u32 i = 0; i < segment_count; ++i) {
+		TRY_MSG(can_use_dma(segments[i].buffer, segments[i].num_blocks))
+		num_blocks += segments[i].num_blocks;
+	}
+	TRY_MSG(num_blocks > 0 && num_blocks <= EMMC_MAX_TRANSFER_BLOCKS)
+
+	device.transfer_blocks = num_blocks;
+	device.transfer_write = write;
+	device.transfer_notify = notify;
+	device.transfer_segments = segments;
+	device.transfer_segment_count = segment_count;
+	// The whole transfer happens in the background, so allow for the slowest rate we expect.
+	device.transfer_deadline = timer_get_micros() + ((u64)TIMEOUT_DEFAULT + (u64)num_blocks * EMMC_BLOCK_SIZE / DMA_MIN_RATE) * 1'000;
+	prepare_dma(write, segments, segment_count);
+
+	if (!command_start(data_command(write, num_blocks) | CMD_DMA, block_address(block_start), 5'000)) {
+		end_dma(false);
+		return false;
+	}
+
+	// Only now may `handle_interrupt` pass the completion on, since `command_start` consumes its own flags.
+	device.transfer_active = true;
+	return true;
+}
+
+bool emmc_start(bool const write, struct emmc_segment const* const segments, u32 const segment_count, u32 const block_start) {
+	LOG_DEBUG("starting %s of %u segments at block %u", write ? "write" : "read", segment_count, block_start);
+	return start_transfer(write, segments, segment_count, block_start, true);
+}
+
+emmc_status_t emmc_poll(void) {
+	if (!device.transfer_active) {
+		return emmc_status_idle;
+	}
+
+	bool const signaled = (device.interrupt_flags | EMMC->interrupt_flags) & (INTERRUPT_DATA_DONE | INTERRUPT_DATA_ERROR);
+	if (!signaled && timer_get_micros() < device.transfer_deadline) {
+		return emmc_status_busy;
+	}
+
+	return finish_transfer() ? emmc_status_done : emmc_status_failed;
+}
+
+bool emmc_wait(void) {
+	TRY_MSG(device.transfer_active)
+
+	u64 const now = timer_get_micros();
+	u32 const remaining_millis = device.transfer_deadline > now ? (u32)((device.transfer_deadline - now + 999) / 1'000) : 0;
+	wait_interrupt(INTERRUPT_DATA_DONE, 0, remaining_millis);
+
+	return finish_transfer();
+}
+
+void emmc_set_completion_handler(emmc_completion_handler_t const handler) {
+	completion_handler = handler;
+}
+
+static bool do_data_command(bool const write, union read_or_write const buffer, u32 num_blocks, u32 block_start) {
 	if (num_blocks == 0) {
 		LOG_DEBUG("data command with 0 blocks, returning early");
 		return true;
 	}
 
-	if (!device.high_capacity) {
-		block_start *= EMMC_BLOCK_SIZE;
-	}
+	TRY_MSG(!device.transfer_active)
 
-	device.transfer_blocks = num_blocks;
+	bool const dma = can_use_dma(buffer.write, num_blocks);
+	// PIO advances this as it goes, so it carries over between chunks.
 	device.buffer = buffer;
+	u8* chunk_buffer = (u8*)(usize)buffer.write;
 
-	static u32 COMMANDS[2][2] = {
-		{ command_read_block, command_read_multiple },
-		{ command_write_block, command_write_multiple },
-	};
-	u32 const command = COMMANDS[write][num_blocks > 1];
+	// The block count register is only 16 bits, so larger transfers are split into several commands.
+	while (num_blocks > 0) {
+		u32 const chunk = num_blocks < EMMC_MAX_TRANSFER_BLOCKS ? num_blocks : EMMC_MAX_TRANSFER_BLOCKS;
+
+		if (dma) {
+			struct emmc_segment const segment = { .buffer = chunk_buffer, .num_blocks = chunk };
+			TRY(start_transfer(write, &segment, 1, block_start, false) && emmc_wait())
+			chunk_buffer += (usize)chunk * EMMC_BLOCK_SIZE;
+		} else {
+			device.transfer_blocks = chunk;
+			TRY(emmc_command(data_command(write, chunk), block_address(block_start), 5'000))
+		}
+
+		num_blocks -= chunk;
+		block_start += chunk;
+	}
+
+	return true;
+}
+
+// Erases (or discards) the blocks with a single CMD32/33/38 sequence and waits for the card to finish.
+static bool erase_range(u32 const block_start, u32 const num_blocks, u32 const mode) {
+	LOG_TRACE("erasing %u blocks at %u with mode %u", num_blocks, block_start, mode);
+
+	TRY_MSG(!device.transfer_active)
+	device.transfer_blocks = 0;
+
+	TRY_MSG(emmc_command(command_erase_start, block_address(block_start), TIMEOUT_DEFAULT))
+	TRY_MSG(emmc_command(command_erase_end, block_address(block_start + num_blocks - 1), TIMEOUT_DEFAULT))
+
+	u32 timeout = ERASE_FALLBACK_TIMEOUT;
+	if (device.au_blocks != 0 && device.erase_au_count != 0 && device.erase_timeout_secs != 0) {
+		u32 const aus = (num_blocks + device.au_blocks - 1) / device.au_blocks;
+		timeout = (device.erase_timeout_secs * aus / device.erase_au_count + device.erase_offset_secs) * 1'000 + TIMEOUT_DEFAULT;
+	}
+
+	TRY_MSG(command_start(command_erase, mode, TIMEOUT_DEFAULT))
+	bool const ret = wait_data_done(timeout);
+	trace_end(ret);
+	return ret;
+}
+
+// The most blocks to erase with a single command, which bounds how long each one keeps the card busy.
+static u32 erase_chunk_blocks(void) {
+	if (device.au_blocks != 0 && device.erase_au_count != 0) {
+		return device.au_blocks * device.erase_au_count;
+	}
+	return ERASE_FALLBACK_BLOCKS;
+}
+
+// Splits the range at allocation unit boundaries, so that the card can drop whole units rather than rewriting partial ones.
+// The partial units at the ends are erased separately, or skipped if `whole_units_only` is set.
+static bool erase_aligned(u32 const block_start, u32 const num_blocks, u32 const mode, bool const whole_units_only) {
+	u32 const end = block_start + num_blocks;
+	u32 const au = device.au_blocks != 0 ? device.au_blocks : 1;
+	u32 const aligned_start = (block_start + au - 1) / au * au;
+	u32 const aligned_end = end / au * au;
+
+	if (aligned_start >= aligned_end) {
+		return whole_units_only || erase_range(block_start, num_blocks, mode);
+	}
+
+	if (!whole_units_only && aligned_start > block_start) {
+		TRY(erase_range(block_start, aligned_start - block_start, mode))
+	}
+
+	u32 const chunk_blocks = erase_chunk_blocks();
+	for (u32 block = aligned_start; block < aligned_end;) {
+		u32 const chunk = aligned_end - block < chunk_blocks ? aligned_end - block : chunk_blocks;
+		TRY(erase_range(block, chunk, mode))
+		block += chunk;
+	}
 
-	return emmc_command(command, block_start, 5'000);
+	if (!whole_units_only && end > aligned_end) {
+		TRY(erase_range(aligned_end, end - aligned_end, mode))
+	}
+
+	return true;
+}
+
+bool emmc_erase(u32 const block_start, u32 const num_blocks) {
+	LOG_DEBUG("erasing %u blocks starting at %u", num_blocks, block_start);
+	if (num_blocks == 0) {
+		return true;
+	}
+	TRY_MSG(block_start + num_blocks <= device.capacity && block_start + num_blocks > block_start)
+	return erase_aligned(block_start, num_blocks, ERASE_ERASE, false);
+}
+
+bool emmc_discard(u32 const block_start, u32 const num_blocks) {
+	LOG_DEBUG("discarding %u blocks starting at %u", num_blocks, block_start);
+	TRY_MSG(block_start + num_blocks <= device.capacity && block_start + num_blocks >= block_start)
+	// Cards without discard support can still drop whole units by erasing them.
+	return erase_aligned(block_start, num_blocks, device.discard ? ERASE_DISCARD : ERASE_ERASE, true);
+}
+
+u8 emmc_erased_byte(void) {
+	return device.scr[SCR_ERASED_ONES_BYTE] & SCR_ERASED_ONES ? 0xff : 0x00;
+}
+
+u32 emmc_allocation_unit(void) {
+	return device.au_blocks;
 }
 
 // Unaligned accesses are fine.
@@ -573,10 +1352,89 @@ bool emmc_read(u8* const buffer, u32 const start_block, u32 const num_blocks) {
 
 bool emmc_write(u8 const* const buffer, u32 const start_block, u32 const num_blocks) {
 	LOG_DEBUG("writing %u blocks starting at %u (0x%x)", num_blocks, start_block, start_block);
+
+	// Erasing is much faster than pushing zeros through PIO, if the card erases to zeros and the range covers at least a whole unit.
+	if (buffer == NULL && emmc_erased_byte() == 0 && device.au_blocks != 0 && num_blocks >= 2 * device.au_blocks) {
+		return emmc_erase(start_block, num_blocks);
+	}
+
 	return do_data_command(true, (union read_or_write){ .write = (u32 const*)buffer }, num_blocks, start_block);
 }
 #pragma GCC diagnostic pop
 
+u32 emmc_trace_read(struct emmc_trace_entry* const out, u32 const capacity) {
+	u32 copied;
+	WITHOUT_INTERRUPTS({
+		u32 const available = trace.count < EMMC_TRACE_SIZE ? trace.count : EMMC_TRACE_SIZE;
+		copied = available < capacity ? available : capacity;
+		for (u32 i = 0; i < copied; ++i) {
+			out[i] = trace.ring[(trace.count - copied + i) % EMMC_TRACE_SIZE];
+		}
+	})
+	return copied;
+}
+
+struct emmc_command_stats emmc_get_command_stats(u8 const index) {
+	struct emmc_command_stats stats;
+	WITHOUT_INTERRUPTS({ stats = trace.commands[index & CMD_MASK_INDEX]; })
+	return stats;
+}
+
+void emmc_trace_reset(void) {
+	WITHOUT_INTERRUPTS({
+		memset(&trace, 0, sizeof(trace));
+	})
+}
+
+// The upper bound of the histogram bucket that contains the percentile.
+static u32 histogram_percentile(struct emmc_command_stats const* const stats, u32 const per_mille) {
+	u64 const wanted = ((u64)stats->count * per_mille + 999) / 1'000;
+	u64 seen = 0;
+	for (u32 bucket = 0; bucket < EMMC_TRACE_HISTOGRAM_BUCKETS; ++bucket) {
+		seen += stats->histogram[bucket];
+		if (seen >= wanted) {
+			return 1u << bucket;
+		}
+	}
+	return stats->max_micros;
+}
+
+void emmc_trace_dump(u32 const entries) {
+	LOG_INFO("EMMC command latencies (application commands are counted with the regular command of the same index):");
+	for (u8 index = 0; index <= CMD_MASK_INDEX; ++index) {
+		struct emmc_command_stats const stats = emmc_get_command_stats(index);
+		if (stats.count == 0) {
+			continue;
+		}
+		LOG_INFO(
+			"CMD%u: %u sent, %u failed, mean %llu us, p50 < %u us, p99 < %u us, max %u us",
+			index,
+			stats.count,
+			stats.errors,
+			stats.total_micros / stats.count,
+			histogram_percentile(&stats, 500),
+			histogram_percentile(&stats, 990),
+			stats.max_micros);
+	}
+
+	struct emmc_trace_entry recent[16];
+	u32 const count = emmc_trace_read(recent, entries < 16 ? entries : 16);
+	for (u32 i = 0; i < count; ++i) {
+		struct emmc_trace_entry const* const entry = &recent[i];
+		LOG_INFO(
+			"CMD%u arg %x blocks %u%s: issued %u, response %u, data %u, done %u us%s",
+			entry->index,
+			entry->arg,
+			entry->blocks,
+			entry->dma ? " (DMA)" : "",
+			entry->issued,
+			entry->response,
+			entry->data,
+			entry->done,
+			entry->ok ? "" : ", failed");
+	}
+}
+
 u32 emmc_capacity(void) {
 	return device.capacity;
 }
@@ -597,5 +1455,7 @@ bool emmc_init(void) {
 	gpio_set_mode(51, gpio_mode_alt3);
 	gpio_set_mode(52, gpio_mode_alt3);
 
+	exception_set_irq_handler(exception_irq_emmc, handle_interrupt);
+
 	return emmc_card_reset();
 }
@@ -0,0 +1,206 @@
+// Pending requests are kept sorted by their first block.
+// When the card becomes idle, we take the first pending request at or after the block where the previous transfer ended, wrapping around to the lowest one (C-LOOK), so that a stream of requests sweeps the card in one direction.
+// The requests that follow it in the same direction and continue exactly where it ends are merged into the same transfer, with one ADMA segment each, so a single CMD18 or CMD25 serves all of them.
+//
+// The next transfer is started from the EMMC interrupt as soon as the previous one finishes, so the card doesn't sit idle until the caller notices.
+// Callbacks run later, from `emmc_queue_poll`, so that they are not limited to what is safe in an interrupt handler.
+// The queue is only changed with IRQs masked, so the interrupt and the callers never see it half-updated.
+
+#include "emmc_queue.h"
+#include "exception.h"
+#include "log.h"
+#include "sleep.h"
+#include "timer.h"
+#include "try.h"
+
+enum : u32 {
+	// How long to sleep between checks while waiting, in microseconds, which bounds how late a timeout is noticed if the interrupt never comes.
+	WAIT_SLICE_MICROS = 1'000,
+};
+
+static struct {
+	// Sorted by `block_start`.
+	struct emmc_request* pending;
+	// The requests in the active transfer, in block order.
+	struct emmc_request* in_flight;
+	// Finished requests whose callbacks have not run yet, oldest first.
+	struct emmc_request* finished;
+	struct emmc_request* finished_tail;
+	struct emmc_segment segments[EMMC_MAX_SEGMENTS];
+	// Where the previous transfer ended.
+	u32 head_block;
+	// Requests that have been submitted but whose callbacks have not run yet.
+	u32 outstanding;
+	// Set whenever a transfer finishes, to wake up waiters.
+	u32 volatile finished_flag;
+	u8 _pad0[4];
+} queue;
+
+static void finish_in_flight(bool const ok) {
+	struct emmc_request* request = queue.in_flight;
+	while (request != NULL) {
+		struct emmc_request* const next = request->next;
+		request->failed = !ok;
+		request->next = NULL;
+		if (queue.finished_tail != NULL) {
+			queue.finished_tail->next = request;
+		} else {
+			queue.finished = request;
+		}
+		queue.finished_tail = request;
+		request = next;
+	}
+	queue.in_flight = NULL;
+	queue.finished_flag = 1;
+}
+
+// Starts a transfer for the next pending requests. Returns false if there are none.
+static bool start_next(void) {
+	while (queue.pending != NULL) {
+		struct emmc_request** first = &queue.pending;
+		for (struct emmc_request** it = &queue.pending; *it != NULL; it = &(*it)->next) {
+			if ((*it)->block_start >= queue.head_block) {
+				first = it;
+				break;
+			}
+		}
+
+		struct emmc_request* const batch = *first;
+		struct emmc_request* last = batch;
+		u32 num_blocks = batch->num_blocks;
+		u32 segment_count = 1;
+		queue.segments[0] = (struct emmc_segment){ .buffer = batch->buffer, .num_blocks = batch->num_blocks };
+		batch->state = emmc_request_in_flight;
+		while (last->next != NULL && segment_count < EMMC_MAX_SEGMENTS) {
+			struct emmc_request* const next = last->next;
+			if (next->write != batch->write || next->block_start != last->block_start + last->num_blocks || num_blocks + next->num_blocks > EMMC_MAX_TRANSFER_BLOCKS) {
+				break;
+			}
+			queue.segments[segment_count++] = (struct emmc_segment){ .buffer = next->buffer, .num_blocks = next->num_blocks };
+			num_blocks += next->num_blocks;
+			next->state = emmc_request_in_flight;
+			last = next;
+		}
+
+		*first = last->next;
+		last->next = NULL;
+		queue.in_flight = batch;
+		queue.head_block = batch->block_start + num_blocks;
+
+		if (emmc_start(batch->write, queue.segments, segment_count, batch->block_start)) {
+			LOG_DEBUG("started %s of %u blocks at %u for %u requests", batch->write ? "write" : "read", num_blocks, batch->block_start, segment_count);
+			return true;
+		}
+
+		LOG_WARN("failed to start %s of %u blocks at %u", batch->write ? "write" : "read", num_blocks, batch->block_start);
+		finish_in_flight(false);
+	}
+
+	return false;
+}
+
+// Must be called with IRQs masked.
+static void advance(void) {
+	while (true) {
+		switch (emmc_poll()) {
+			case emmc_status_busy:
+				return;
+			case emmc_status_done:
+				finish_in_flight(true);
+				break;
+			case emmc_status_failed:
+				finish_in_flight(false);
+				break;
+			case emmc_status_idle:
+				break;
+		}
+
+		// The transfer may have finished before the driver would notify us about it, so check again.
+		if (!start_next()) {
+			return;
+		}
+	}
+}
+
+static void run_callbacks(void) {
+	while (true) {
+		struct emmc_request* request;
+		WITHOUT_INTERRUPTS({
+			request = queue.finished;
+			if (request != NULL) {
+				queue.finished = request->next;
+				if (queue.finished == NULL) {
+					queue.finished_tail = NULL;
+				}
+				--queue.outstanding;
+			}
+		})
+
+		if (request == NULL) {
+			return;
+		}
+
+		request->next = NULL;
+		request->state = request->failed ? emmc_request_failed : emmc_request_done;
+		if (request->callback != NULL) {
+			request->callback(request);
+		}
+	}
+}
+
+void emmc_queue_init(void) {
+	emmc_set_completion_handler(advance);
+}
+
+bool emmc_queue_submit(struct emmc_request* const request) {
+	TRY_MSG(request->num_blocks > 0 && request->num_blocks <= EMMC_MAX_TRANSFER_BLOCKS)
+	TRY_MSG(emmc_can_dma(request->buffer, request->num_blocks))
+
+	request->state = emmc_request_pending;
+	request->failed = false;
+
+	WITHOUT_INTERRUPTS({
+		// Requests for the same block stay in the order they were submitted.
+		struct emmc_request** it = &queue.pending;
+		while (*it != NULL && (*it)->block_start <= request->block_start) {
+			it = &(*it)->next;
+		}
+		request->next = *it;
+		*it = request;
+		++queue.outstanding;
+
+		if (queue.in_flight == NULL) {
+			advance();
+		}
+	})
+
+	return true;
+}
+
+u32 emmc_queue_poll(void) {
+	WITHOUT_INTERRUPTS({
+		// Cleared first so that a transfer finishing after this point still wakes up the next wait.
+		queue.finished_flag = 0;
+		advance();
+	})
+
+	run_callbacks();
+	return queue.outstanding;
+}
+
+bool emmc_queue_wait(struct emmc_request* const request) {
+	while (true) {
+		emmc_queue_poll();
+		emmc_request_state_t const state = request->state;
+		if (state == emmc_request_done || state == emmc_request_failed) {
+			return state == emmc_request_done;
+		}
+		sleep_until_flag(&queue.finished_flag, 1, timer_get_micros() + WAIT_SLICE_MICROS);
+	}
+}
+
+void emmc_queue_drain(void) {
+	while (emmc_queue_poll() > 0) {
+		sleep_until_flag(&queue.finished_flag, 1, timer_get_micros() + WAIT_SLICE_MICROS);
+	}
+}
@@ -59,10 +59,25 @@ static struct {
 	u32 irq0_disable[3];
 } volatile* const IRQ_BASE = (void volatile*)(PERIPHERAL_BASE + 0xb200);
 
+static exception_irq_handler_t emmc_handler = NULL;
+
 static void init_controller(void) {
 	IRQ_BASE->irq0_enable[0] = IRQ0_TIMER1;
 }
 
+void exception_set_irq_handler(exception_irq_t const irq, exception_irq_handler_t const handler) {
+	switch (irq) {
+		case exception_irq_emmc:
+			emmc_handler = handler;
+			if (handler != NULL) {
+				IRQ_BASE->irq0_enable[1] = IRQ1_EMMC;
+			} else {
+				IRQ_BASE->irq0_disable[1] = IRQ1_EMMC;
+			}
+			break;
+	}
+}
+
 void exception_init(void) {
 	asm volatile("adr x0, exception_vector_table\nmsr vbar_el1, x0" ::: "x0");
 	init_controller();
@@ -81,10 +96,15 @@ void exception_handle_invalid(u64 const index) {
 
 void exception_handle_el1_irq(void) {
 	u32 const pending0 = IRQ_BASE->irq0_pending[0];
+	u32 const pending1 = IRQ_BASE->irq0_pending[1];
 
 	if (pending0 & IRQ0_TIMER1) {
 		timer_acknowledge(1);
 	}
+
+	if ((pending1 & IRQ1_EMMC) && emmc_handler != NULL) {
+		emmc_handler();
+	}
 }
 
 exception_mask_t exception_get_mask(void) {
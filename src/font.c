@@ -0,0 +1,197 @@
+// Generated by `tools/gen-font.py` from DejaVu Sans Mono. Do not edit by hand.
+// DejaVu fonts are derived from Bitstream Vera; see <https://dejavu-fonts.github.io/License.html>.
+
+#include "font.h"
+
+u8 const FONT_GLYPHS[FONT_GLYPH_COUNT][FONT_HEIGHT] = {
+	// ' '
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '!'
+	{ 0x00, 0x18, 0x18, 0x18, 0x18, 0x18, 0x08, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '"'
+	{ 0x00, 0x34, 0x34, 0x34, 0x34, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '#'
+	{ 0x00, 0x1a, 0x12, 0x12, 0x7f, 0x34, 0x24, 0xff, 0x2c, 0x68, 0x48, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '$'
+	{ 0x08, 0x08, 0x3c, 0x6a, 0x68, 0x68, 0x3c, 0x0a, 0x0b, 0x4a, 0x3e, 0x08, 0x08, 0x00, 0x00, 0x00 },
+	// '%'
+	{ 0x00, 0x70, 0xd8, 0xd8, 0x73, 0x0c, 0x30, 0x46, 0x09, 0x09, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '&'
+	{ 0x00, 0x3c, 0x20, 0x20, 0x30, 0x70, 0x59, 0xcd, 0xc7, 0x66, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// "'"
+	{ 0x00, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '('
+	{ 0x04, 0x08, 0x08, 0x18, 0x10, 0x10, 0x10, 0x10, 0x18, 0x08, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00 },
+	// ')'
+	{ 0x10, 0x10, 0x18, 0x08, 0x08, 0x0c, 0x0c, 0x08, 0x08, 0x18, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+	// '*'
+	{ 0x00, 0x08, 0x6a, 0x3c, 0x3c, 0x6a, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '+'
+	{ 0x00, 0x00, 0x00, 0x08, 0x08, 0x08, 0x7f, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// ','
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x10, 0x00, 0x00, 0x00 },
+	// '-'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '.'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '/'
+	{ 0x00, 0x02, 0x06, 0x04, 0x0c, 0x08, 0x08, 0x18, 0x10, 0x30, 0x20, 0x60, 0x40, 0x00, 0x00, 0x00 },
+	// '0'
+	{ 0x00, 0x3c, 0x26, 0x62, 0x43, 0x43, 0x5b, 0x43, 0x62, 0x26, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '1'
+	{ 0x00, 0x18, 0x28, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '2'
+	{ 0x00, 0x3c, 0x46, 0x02, 0x06, 0x06, 0x0c, 0x18, 0x30, 0x60, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '3'
+	{ 0x00, 0x3c, 0x46, 0x02, 0x06, 0x1c, 0x06, 0x02, 0x02, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '4'
+	{ 0x00, 0x0e, 0x0e, 0x16, 0x36, 0x26, 0x46, 0x7f, 0x06, 0x06, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '5'
+	{ 0x00, 0x7e, 0x60, 0x60, 0x7c, 0x46, 0x02, 0x02, 0x02, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '6'
+	{ 0x00, 0x1c, 0x32, 0x60, 0x40, 0x7c, 0x66, 0x63, 0x63, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '7'
+	{ 0x00, 0x7e, 0x02, 0x06, 0x04, 0x0c, 0x0c, 0x08, 0x18, 0x10, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '8'
+	{ 0x00, 0x3c, 0x66, 0x62, 0x66, 0x3c, 0x66, 0x43, 0x43, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '9'
+	{ 0x00, 0x3c, 0x66, 0x42, 0x42, 0x67, 0x3f, 0x02, 0x02, 0x06, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// ':'
+	{ 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// ';'
+	{ 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x18, 0x18, 0x18, 0x10, 0x00, 0x00, 0x00 },
+	// '<'
+	{ 0x00, 0x00, 0x00, 0x03, 0x0e, 0x78, 0x60, 0x78, 0x0e, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '='
+	{ 0x00, 0x00, 0x00, 0x00, 0x7f, 0x00, 0x00, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '>'
+	{ 0x00, 0x00, 0x00, 0x40, 0x78, 0x0e, 0x03, 0x0e, 0x78, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '?'
+	{ 0x00, 0x3c, 0x26, 0x02, 0x06, 0x0c, 0x18, 0x18, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '@'
+	{ 0x00, 0x1e, 0x23, 0x41, 0xcf, 0x9b, 0x91, 0x91, 0x9b, 0xcf, 0x40, 0x30, 0x1e, 0x00, 0x00, 0x00 },
+	// 'A'
+	{ 0x00, 0x18, 0x1c, 0x34, 0x34, 0x26, 0x26, 0x7e, 0x42, 0x43, 0xc1, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'B'
+	{ 0x00, 0x7c, 0x66, 0x62, 0x66, 0x7c, 0x62, 0x63, 0x63, 0x63, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'C'
+	{ 0x00, 0x1e, 0x32, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x32, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'D'
+	{ 0x00, 0x7c, 0x46, 0x42, 0x43, 0x43, 0x43, 0x43, 0x42, 0x46, 0x7c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'E'
+	{ 0x00, 0x7f, 0x60, 0x60, 0x60, 0x7e, 0x60, 0x60, 0x60, 0x60, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'F'
+	{ 0x00, 0x7f, 0x60, 0x60, 0x60, 0x7e, 0x60, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'G'
+	{ 0x00, 0x1e, 0x32, 0x60, 0x40, 0x40, 0x47, 0x43, 0x63, 0x33, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'H'
+	{ 0x00, 0x43, 0x43, 0x43, 0x43, 0x7f, 0x43, 0x43, 0x43, 0x43, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'I'
+	{ 0x00, 0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'J'
+	{ 0x00, 0x3e, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x4c, 0x78, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'K'
+	{ 0x00, 0x43, 0x46, 0x4c, 0x58, 0x78, 0x68, 0x4c, 0x46, 0x42, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'L'
+	{ 0x00, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'M'
+	{ 0x00, 0xe3, 0xe7, 0xe7, 0xd7, 0xdb, 0xdb, 0xc3, 0xc3, 0xc3, 0xc3, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'N'
+	{ 0x00, 0x63, 0x63, 0x73, 0x53, 0x5b, 0x4b, 0x4f, 0x47, 0x47, 0x47, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'O'
+	{ 0x00, 0x3c, 0x66, 0x62, 0x43, 0x43, 0x43, 0x43, 0x62, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'P'
+	{ 0x00, 0x7e, 0x63, 0x63, 0x63, 0x63, 0x7e, 0x60, 0x60, 0x60, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'Q'
+	{ 0x00, 0x3c, 0x66, 0x62, 0x43, 0x43, 0x43, 0x43, 0x62, 0x66, 0x3c, 0x06, 0x02, 0x00, 0x00, 0x00 },
+	// 'R'
+	{ 0x00, 0x7c, 0x46, 0x42, 0x42, 0x46, 0x7c, 0x46, 0x42, 0x43, 0x41, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'S'
+	{ 0x00, 0x3c, 0x62, 0x40, 0x60, 0x38, 0x1e, 0x02, 0x03, 0x46, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'T'
+	{ 0x00, 0xff, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'U'
+	{ 0x00, 0x43, 0x43, 0x43, 0x43, 0x43, 0x43, 0x43, 0x62, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'V'
+	{ 0x00, 0xc3, 0x43, 0x62, 0x62, 0x26, 0x26, 0x34, 0x1c, 0x1c, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'W'
+	{ 0x00, 0xc1, 0xc1, 0xc1, 0xd9, 0x5b, 0x5f, 0x77, 0x76, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'X'
+	{ 0x00, 0x43, 0x62, 0x36, 0x1c, 0x18, 0x1c, 0x34, 0x26, 0x62, 0xc3, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'Y'
+	{ 0x00, 0xc3, 0x62, 0x26, 0x34, 0x1c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'Z'
+	{ 0x00, 0x7f, 0x03, 0x06, 0x04, 0x0c, 0x18, 0x10, 0x30, 0x60, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '['
+	{ 0x1c, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1c, 0x00, 0x00, 0x00, 0x00 },
+	// '\\'
+	{ 0x00, 0x40, 0x60, 0x20, 0x30, 0x10, 0x18, 0x08, 0x08, 0x0c, 0x04, 0x06, 0x02, 0x00, 0x00, 0x00 },
+	// ']'
+	{ 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x38, 0x00, 0x00, 0x00, 0x00 },
+	// '^'
+	{ 0x00, 0x18, 0x3c, 0x26, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '_'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00 },
+	// '`'
+	{ 0x10, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'a'
+	{ 0x00, 0x00, 0x00, 0x3c, 0x66, 0x02, 0x3e, 0x62, 0x42, 0x66, 0x3a, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'b'
+	{ 0x60, 0x60, 0x60, 0x7c, 0x66, 0x63, 0x63, 0x63, 0x63, 0x66, 0x7c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'c'
+	{ 0x00, 0x00, 0x00, 0x1e, 0x32, 0x60, 0x60, 0x60, 0x60, 0x32, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'd'
+	{ 0x02, 0x02, 0x02, 0x3e, 0x66, 0x42, 0x42, 0x42, 0x42, 0x66, 0x3e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'e'
+	{ 0x00, 0x00, 0x00, 0x3c, 0x62, 0x43, 0x7f, 0x40, 0x60, 0x62, 0x3e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'f'
+	{ 0x0e, 0x18, 0x18, 0x7e, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'g'
+	{ 0x00, 0x00, 0x00, 0x3e, 0x66, 0x42, 0x42, 0x42, 0x42, 0x66, 0x3e, 0x02, 0x26, 0x3c, 0x00, 0x00 },
+	// 'h'
+	{ 0x60, 0x60, 0x60, 0x7c, 0x66, 0x62, 0x62, 0x62, 0x62, 0x62, 0x62, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'i'
+	{ 0x08, 0x08, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'j'
+	{ 0x08, 0x08, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x78, 0x00, 0x00 },
+	// 'k'
+	{ 0x20, 0x20, 0x20, 0x22, 0x24, 0x28, 0x38, 0x2c, 0x26, 0x22, 0x23, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'l'
+	{ 0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x18, 0x18, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'm'
+	{ 0x00, 0x00, 0x00, 0x7e, 0x5b, 0x4b, 0x49, 0x49, 0x49, 0x49, 0x49, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'n'
+	{ 0x00, 0x00, 0x00, 0x7c, 0x66, 0x62, 0x62, 0x62, 0x62, 0x62, 0x62, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'o'
+	{ 0x00, 0x00, 0x00, 0x3c, 0x66, 0x62, 0x43, 0x43, 0x62, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'p'
+	{ 0x00, 0x00, 0x00, 0x7c, 0x66, 0x62, 0x63, 0x63, 0x62, 0x66, 0x7c, 0x60, 0x60, 0x60, 0x00, 0x00 },
+	// 'q'
+	{ 0x00, 0x00, 0x00, 0x3e, 0x66, 0x62, 0x42, 0x42, 0x62, 0x66, 0x3a, 0x02, 0x02, 0x02, 0x00, 0x00 },
+	// 'r'
+	{ 0x00, 0x00, 0x00, 0x3f, 0x38, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 's'
+	{ 0x00, 0x00, 0x00, 0x3c, 0x22, 0x60, 0x38, 0x0e, 0x02, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 't'
+	{ 0x00, 0x10, 0x10, 0x7e, 0x10, 0x10, 0x10, 0x10, 0x10, 0x18, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'u'
+	{ 0x00, 0x00, 0x00, 0x62, 0x62, 0x62, 0x62, 0x62, 0x62, 0x66, 0x3a, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'v'
+	{ 0x00, 0x00, 0x00, 0x43, 0x62, 0x62, 0x26, 0x34, 0x34, 0x1c, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'w'
+	{ 0x00, 0x00, 0x00, 0x81, 0xc1, 0xd9, 0x5b, 0x5b, 0x76, 0x66, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'x'
+	{ 0x00, 0x00, 0x00, 0x62, 0x26, 0x3c, 0x18, 0x18, 0x34, 0x66, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// 'y'
+	{ 0x00, 0x00, 0x00, 0x43, 0x62, 0x22, 0x26, 0x34, 0x1c, 0x1c, 0x18, 0x18, 0x10, 0x70, 0x00, 0x00 },
+	// 'z'
+	{ 0x00, 0x00, 0x00, 0x7e, 0x06, 0x04, 0x08, 0x18, 0x30, 0x20, 0x7e, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	// '{'
+	{ 0x0e, 0x08, 0x08, 0x08, 0x18, 0x18, 0x70, 0x18, 0x18, 0x08, 0x08, 0x08, 0x0e, 0x00, 0x00, 0x00 },
+	// '|'
+	{ 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00 },
+	// '}'
+	{ 0x70, 0x18, 0x18, 0x18, 0x18, 0x08, 0x0e, 0x08, 0x18, 0x18, 0x18, 0x18, 0x70, 0x00, 0x00, 0x00 },
+	// '~'
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x79, 0x0e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
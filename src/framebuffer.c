@@ -75,6 +75,14 @@ void framebuffer_init(void) {
 	}
 }
 
+u32 framebuffer_width(void) {
+	return framebuffer.width;
+}
+
+u32 framebuffer_height(void) {
+	return framebuffer.height;
+}
+
 void framebuffer_draw_pixel(u32 const x, u32 const y, framebuffer_color_t const color) {
 	if (y > framebuffer.height || x > framebuffer.width) {
 		return;
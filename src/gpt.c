@@ -3,7 +3,7 @@
 // - <https://en.wikipedia.org/wiki/GUID_Partition_Table>
 // - <https://developer.apple.com/library/archive/technotes/tn2166/_index.html#//apple_ref/doc/uid/DTS10003927-CH1-SUBSECTION11>
 
-#include "emmc.h"
+#include "block_device.h"
 #include "gpt.h"
 #include "string.h"
 #include "try.h"
@@ -49,10 +49,10 @@ struct __attribute__((packed)) gpt_partition_entry {
 	u16 partition_name[36];
 };
 
-bool find_partition_by_guid(guid_t const* const expected_id, struct lba_range* const ret) {
-	u8 buf[EMMC_BLOCK_SIZE] __attribute__((aligned(alignof(struct gpt_header))));
+bool find_partition_by_guid(struct block_device* const device, guid_t const* const expected_id, struct lba_range* const ret) {
+	u8 buf[BLOCK_DEVICE_BLOCK_SIZE] __attribute__((aligned(alignof(struct gpt_header))));
 
-	TRY_MSG(emmc_read(buf, GPT_HEADER_LBA, 1))
+	TRY_MSG(block_device_read(device, buf, GPT_HEADER_LBA, 1))
 
 	_Static_assert(sizeof(struct gpt_header) <= sizeof(buf));
 	_Static_assert(alignof(struct gpt_header) <= alignof(buf));
@@ -71,14 +71,14 @@ bool find_partition_by_guid(guid_t const* const expected_id, struct lba_range* c
 	u32 const num_entries = header->number_of_partitions;
 	u32 const entry_size = header->size_of_partitions_table_entry;
 	TRY_MSG(entry_size >= sizeof(struct gpt_partition_entry))
-	TRY_MSG(EMMC_BLOCK_SIZE % entry_size == 0)
-	u32 const entries_per_block = EMMC_BLOCK_SIZE / entry_size;
+	TRY_MSG(BLOCK_DEVICE_BLOCK_SIZE % entry_size == 0)
+	u32 const entries_per_block = BLOCK_DEVICE_BLOCK_SIZE / entry_size;
 
 	{
 		u32 block = table_base;
 		u32 entry_idx = 0;
 		while (entry_idx < num_entries) {
-			assert(emmc_read(buf, block, 1), "reading");
+			assert(block_device_read(device, buf, block, 1), "reading");
 			for (u32 entry_in_block = 0; entry_in_block < entries_per_block; ++entry_in_block) {
 				struct gpt_partition_entry const* const entry = (struct gpt_partition_entry const*)&buf[entry_in_block * entry_size];
 
@@ -0,0 +1,136 @@
+// Measures block device throughput on the host, over a RAM disk or a disk image, both directly and through the block cache.
+// On RAM disks, it also measures small scattered writes with and without write staging.
+//
+// Usage: `target/host/block-bench [image]`
+//
+// Images are only read from, so that this is safe to point at a copy of a real SD card.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "block_cache.h"
+#include "block_device.h"
+#include "timer.h"
+#include "write_stage.h"
+
+enum : u32 {
+	RAM_DISK_BLOCKS = 128 * 1'024,
+	REQUEST_BLOCKS = 128,
+	RANDOM_REQUEST_BLOCKS = 8,
+	RANDOM_REQUESTS = 20'000,
+	// Random reads stay within this many blocks, so that some of them hit the cache.
+	RANDOM_SPAN = 16 * 1'024,
+	// Small writes go to this many streams at once, each of which writes sequentially, like a file system writing data and metadata.
+	WRITE_STREAMS = 2,
+	SMALL_WRITE_BLOCKS = 8,
+};
+
+static u8 buffer[REQUEST_BLOCKS * BLOCK_DEVICE_BLOCK_SIZE];
+
+static void report(char const* const device, char const* const test, u64 const blocks, u64 const requests, u64 const micros) {
+	double const seconds = (double)(micros > 0 ? micros : 1) / 1e6;
+	printf("%-6s %-16s %9.1f MB/s %10.0f IOPS\n", device, test, (double)blocks * BLOCK_DEVICE_BLOCK_SIZE / 1e6 / seconds, (double)requests / seconds);
+}
+
+static bool sequential(struct block_device* const device, bool const write, u32 const num_blocks) {
+	u64 const start = timer_get_micros();
+	for (u32 block = 0; block + REQUEST_BLOCKS <= num_blocks; block += REQUEST_BLOCKS) {
+		if (!(write ? block_device_write(device, buffer, block, REQUEST_BLOCKS) : block_device_read(device, buffer, block, REQUEST_BLOCKS))) {
+			return false;
+		}
+	}
+	if (write && !block_device_flush(device)) {
+		return false;
+	}
+	report(device->name, write ? "sequential write" : "sequential read", num_blocks, num_blocks / REQUEST_BLOCKS, timer_get_micros() - start);
+	return true;
+}
+
+static bool random_reads(struct block_device* const device, u32 const num_blocks) {
+	u32 const span = (num_blocks < RANDOM_SPAN ? num_blocks : RANDOM_SPAN) / RANDOM_REQUEST_BLOCKS;
+	u32 state = 0x1234'5678;
+	u64 const start = timer_get_micros();
+	for (u32 i = 0; i < RANDOM_REQUESTS; ++i) {
+		// xorshift32
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		if (!block_device_read(device, buffer, state % span * RANDOM_REQUEST_BLOCKS, RANDOM_REQUEST_BLOCKS)) {
+			return false;
+		}
+	}
+	report(device->name, "random read", (u64)RANDOM_REQUESTS * RANDOM_REQUEST_BLOCKS, RANDOM_REQUESTS, timer_get_micros() - start);
+	return true;
+}
+
+static bool small_writes(struct block_device* const device, u32 const num_blocks) {
+	u32 const stream_blocks = num_blocks / WRITE_STREAMS;
+	u64 const start = timer_get_micros();
+	for (u32 offset = 0; offset + SMALL_WRITE_BLOCKS <= stream_blocks; offset += SMALL_WRITE_BLOCKS) {
+		for (u32 stream = 0; stream < WRITE_STREAMS; ++stream) {
+			if (!block_device_write(device, buffer, stream * stream_blocks + offset, SMALL_WRITE_BLOCKS)) {
+				return false;
+			}
+		}
+	}
+	if (!block_device_flush(device)) {
+		return false;
+	}
+	report(device->name, "small writes", stream_blocks / SMALL_WRITE_BLOCKS * SMALL_WRITE_BLOCKS * WRITE_STREAMS, stream_blocks / SMALL_WRITE_BLOCKS * WRITE_STREAMS, timer_get_micros() - start);
+	return true;
+}
+
+static bool run(struct block_device* const device, bool const writable) {
+	u32 const num_blocks = block_device_capacity(device);
+	if (writable) {
+		for (usize i = 0; i < sizeof(buffer); ++i) {
+			buffer[i] = (u8)i;
+		}
+		if (!sequential(device, true, num_blocks)) {
+			return false;
+		}
+	}
+	return sequential(device, false, num_blocks) && random_reads(device, num_blocks);
+}
+
+int main(int const argc, char** const argv) {
+	struct block_device_ram ram;
+	struct block_device_file file;
+	struct block_device* device;
+	bool writable;
+
+	if (argc > 1) {
+		if (!block_device_file_open(&file, argv[1])) {
+			fprintf(stderr, "could not open %s\n", argv[1]);
+			return 1;
+		}
+		device = &file.device;
+		writable = false;
+	} else {
+		u8* const memory = calloc(RAM_DISK_BLOCKS, BLOCK_DEVICE_BLOCK_SIZE);
+		if (memory == NULL) {
+			return 1;
+		}
+		block_device_ram_init(&ram, memory, RAM_DISK_BLOCKS);
+		device = &ram.device;
+		writable = true;
+	}
+
+	if (!run(device, writable) || !block_cache_init(device) || !run(&block_cache_device, writable)) {
+		fprintf(stderr, "benchmark failed\n");
+		return 1;
+	}
+
+	struct block_cache_stats const stats = block_cache_get_stats();
+	printf("cache: %llu hits, %llu misses, %llu read ahead (%llu used), %llu written back, %llu evicted\n", stats.hits, stats.misses, stats.read_ahead, stats.read_ahead_hits, stats.write_backs, stats.evictions);
+
+	if (writable) {
+		if (!small_writes(device, RAM_DISK_BLOCKS) || !write_stage_init(device) || !small_writes(&write_stage_device, RAM_DISK_BLOCKS)) {
+			fprintf(stderr, "benchmark failed\n");
+			return 1;
+		}
+		struct write_stage_stats const stage = write_stage_get_stats();
+		printf("stage: %llu blocks staged, %llu full units, %llu filled (%llu blocks read), %llu partial, %llu direct\n", stage.staged_blocks, stage.full_units, stage.filled_units, stage.fill_blocks, stage.partial_units, stage.direct_units);
+	}
+	return 0;
+}
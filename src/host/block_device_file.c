@@ -0,0 +1,73 @@
+// A block device backed by a disk image, for the host build.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_device.h"
+#include "log.h"
+#include "try.h"
+
+static int file_fd(struct block_device* const device) {
+	return ((struct block_device_file*)device)->fd;
+}
+
+static bool file_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	usize const length = (usize)num_blocks * BLOCK_DEVICE_BLOCK_SIZE;
+	return pread(file_fd(device), buffer, length, (off_t)block_start * BLOCK_DEVICE_BLOCK_SIZE) == (ssize_t)length;
+}
+
+static bool file_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 num_blocks) {
+	if (buffer != NULL) {
+		usize const length = (usize)num_blocks * BLOCK_DEVICE_BLOCK_SIZE;
+		return pwrite(file_fd(device), buffer, length, (off_t)block_start * BLOCK_DEVICE_BLOCK_SIZE) == (ssize_t)length;
+	}
+
+	static u8 const ZEROS[64 * BLOCK_DEVICE_BLOCK_SIZE];
+	u32 block = block_start;
+	while (num_blocks > 0) {
+		u32 const chunk = num_blocks < 64 ? num_blocks : 64;
+		TRY(file_write(device, ZEROS, block, chunk))
+		block += chunk;
+		num_blocks -= chunk;
+	}
+	return true;
+}
+
+static bool file_flush(struct block_device* const device) {
+	return fsync(file_fd(device)) == 0;
+}
+
+static u32 file_capacity(struct block_device* const device) {
+	return ((struct block_device_file*)device)->num_blocks;
+}
+
+static struct block_device_ops const FILE_OPS = {
+	.read = file_read,
+	.write = file_write,
+	.flush = file_flush,
+	.capacity = file_capacity,
+};
+
+bool block_device_file_open(struct block_device_file* const file, char const* const path) {
+	int const fd = open(path, O_RDWR);
+	TRY_MSG(fd >= 0)
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+
+	*file = (struct block_device_file){
+		.device = { .ops = &FILE_OPS, .name = path },
+		.fd = fd,
+		.num_blocks = (u32)(info.st_size / BLOCK_DEVICE_BLOCK_SIZE),
+	};
+	return true;
+}
+
+void block_device_file_close(struct block_device_file* const file) {
+	close(file->fd);
+	file->fd = -1;
+}
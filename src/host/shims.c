@@ -0,0 +1,25 @@
+// The few kernel services that the storage code needs, implemented on top of the host's C library.
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "halt.h"
+#include "mailbox.h"
+#include "timer.h"
+
+void halt(void) {
+	abort();
+}
+
+u64 timer_get_micros(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1'000'000 + (u64)now.tv_nsec / 1'000;
+}
+
+// Sizes the block cache as if we were running on a Raspberry Pi with 1 GiB of ARM memory.
+bool mailbox_get_arm_memory(u32* const base, u32* const size) {
+	*base = 0;
+	*size = 1u << 30;
+	return true;
+}
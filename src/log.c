@@ -1,19 +1,1047 @@
+// # Sinks
+//
+// Each record is formatted at most once and then passed to every registered sink whose threshold it meets.
+// Sinks either take the formatted text or the tokenized encoding below; the text is only produced if a sink wants it, and vice versa.
+// Both are built in buffers on the stack, limited to `LOG_RECORD_MAX` bytes.
+// Text is truncated with `...`; if the tokens don't fit, token sinks fall back to sending the truncated text as a dynamic record.
+//
+// # Tokenized Records
+//
+// When `LOG_TOKENIZED` is enabled, the UART sink sends each record as follows:
+// - `TOKEN_RECORD_START`.
+// - The site ID as a varint: the index of the site in the `.log_sites` section plus one, or `TOKEN_DYNAMIC_SITE` for `log_write`.
+// - The number of timer ticks since the previous record as a varint.
+// - Only if `LOG_CORE_ID` is enabled: the core ID as a single byte.
+// - Only for dynamic sites: the file as a string, the line and level as varints, and the format string as a string.
+// - The arguments, in the order the format string consumes them.
+//
+// Varints are LEB128: 7 bits per byte, least significant group first, with the top bit set on all but the last byte.
+// Signed integers are zigzag-encoded before being written as varints so that small negative numbers stay small.
+// Strings and `%@d` data are written as a varint length followed by the bytes.
+// Floats are written as the 8 raw bytes of the `f64`, little-endian.
+// `%c` is a single raw byte and `%n` is not sent at all.
+//
+// Before the first record, and then periodically so that a decoder can join at any point, we send a clock record:
+// - `TOKEN_CLOCK_START`.
+// - The timer frequency in hertz as a varint.
+// - The absolute timer count as a varint, which the next record's delta is relative to.
+// - Flags as a varint; `TOKEN_FLAG_CORE_ID` is set if records include core IDs.
+//
+// `tools/log-decode.py` implements the other side of this format.
+
+#include "console.h"
+#include "exception.h"
 #include "log.h"
+#include "printf.h"
+#include "string.h"
+#include "timer.h"
 #include "uart.h"
 
 static char const* const LEVELS[] = { "trace", "debug", "info", "warn", "error", "fatal", "???" };
-static char const* const COLORS[] = { "0;37", "0", "1;30", "1;33", "1;31", "41m\e[1;97" };
 
 #define CLAMPED_GET(_arr, _index) _arr[_index >= sizeof(_arr) / sizeof(_arr[0]) ? sizeof(_arr) / sizeof(_arr[0]) - 1 : _index]
 
-void log_write(char const* const file, u32 const line, u32 const level, char const* const fmt, ...) {
-	u32 const level_index = (level - 1) / 10;
-	uart_printf("\e[%sm[%s %s:%u] ", CLAMPED_GET(COLORS, level_index), CLAMPED_GET(LEVELS, level_index), file, line);
+static u8 current_core(void) {
+	u64 mpidr;
+	asm("mrs %0, mpidr_el1" : "=r"(mpidr));
+	return (u8)(mpidr & 0xff);
+}
+
+// Registered sinks, most recently added first.
+static struct log_sink* sinks = &log_sink_uart;
+
+// Provided by the linker script.
+extern struct log_module __log_modules_start[];
+extern struct log_module __log_modules_end[];
+extern struct log_site __log_sites_start[];
+extern struct log_site __log_sites_end[];
+
+// Strips the `src/` prefix and `.c` suffix, which are the same for every module.
+static char const* module_short_name(char const* name, usize* const length) {
+	usize name_length = strlen(name);
+	if (name_length >= 4 && memcmp(name, "src/", 4) == 0) {
+		name += 4;
+		name_length -= 4;
+	}
+	if (name_length >= 2 && memcmp(&name[name_length - 2], ".c", 2) == 0) {
+		name_length -= 2;
+	}
+	*length = name_length;
+	return name;
+}
+
+static u32 set_level(char const* const pattern, usize const pattern_length, u32 const level) {
+	bool const all = pattern_length == 1 && pattern[0] == '*';
+
+	u32 changed = 0;
+	for (struct log_module* module = __log_modules_start; module < __log_modules_end; ++module) {
+		usize length;
+		char const* const name = module_short_name(module->name, &length);
+		if (all || (length == pattern_length && memcmp(name, pattern, length) == 0)) {
+			module->level = level;
+			++changed;
+		}
+	}
+	return changed;
+}
+
+u32 log_set_level(char const* const module, u32 const level) {
+	return set_level(module, strlen(module), level);
+}
+
+static bool parse_level(char const* const source, usize const length, u32* const ret) {
+	for (u32 i = 0; i < sizeof(LEVELS) / sizeof(LEVELS[0]) - 1; ++i) {
+		if (strlen(LEVELS[i]) == length && memcmp(LEVELS[i], source, length) == 0) {
+			*ret = (i + 1) * 10;
+			return true;
+		}
+	}
+
+	bool valid;
+	u64 const value = parse_u64(source, length, &valid);
+	if (!valid || value > U32_MAX) {
+		return false;
+	}
+	*ret = (u32)value;
+	return true;
+}
+
+// Returns the next space-separated word, or `NULL` if there are none left.
+static char const* next_word(char const** const cursor, usize* const length) {
+	char const* start = *cursor;
+	while (*start == ' ') {
+		++start;
+	}
+	if (*start == '\0') {
+		return NULL;
+	}
+
+	char const* end = start;
+	while (*end != ' ' && *end != '\0') {
+		++end;
+	}
+
+	*cursor = end;
+	*length = (usize)(end - start);
+	return start;
+}
+
+bool log_control_command(char const* command) {
+	usize length;
+	char const* const name = next_word(&command, &length);
+	if (name == NULL) {
+		return true;
+	}
+
+	if (length == 6 && memcmp(name, "levels", 6) == 0) {
+		for (struct log_module const* module = __log_modules_start; module < __log_modules_end; ++module) {
+			usize module_length;
+			char const* const module_name = module_short_name(module->name, &module_length);
+			LOG_INFO("%.*s: %s (%u)", (int)module_length, module_name, CLAMPED_GET(LEVELS, (module->level - 1) / 10), module->level);
+		}
+		return true;
+	}
+
+	if (length == 5 && memcmp(name, "level", 5) == 0) {
+		usize module_length, level_length;
+		char const* const module = next_word(&command, &module_length);
+		char const* const level_name = module != NULL ? next_word(&command, &level_length) : NULL;
+		u32 level;
+		if (level_name == NULL || !parse_level(level_name, level_length, &level)) {
+			LOG_WARN("usage: level <module> <level>");
+			return false;
+		}
+
+		u32 const changed = set_level(module, module_length, level);
+		LOG_INFO("set level of %u module(s) matching %.*s to %u", changed, (int)module_length, module, level);
+		return changed > 0;
+	}
+
+	if (length == 5 && memcmp(name, "sinks", 5) == 0) {
+		for (struct log_sink const* sink = sinks; sink != NULL; sink = sink->next) {
+			LOG_INFO("%s: %s (%u)%s", sink->name, CLAMPED_GET(LEVELS, (sink->level - 1) / 10), sink->level, sink->tokens ? ", tokenized" : "");
+		}
+		return true;
+	}
+
+	if (length == 4 && memcmp(name, "sink", 4) == 0) {
+		usize sink_length, level_length;
+		char const* const sink_name = next_word(&command, &sink_length);
+		char const* const level_name = sink_name != NULL ? next_word(&command, &level_length) : NULL;
+		u32 level;
+		if (level_name == NULL || !parse_level(level_name, level_length, &level)) {
+			LOG_WARN("usage: sink <sink> <level>");
+			return false;
+		}
+
+		struct log_sink* const sink = log_sink_find(sink_name, sink_length);
+		if (sink == NULL) {
+			LOG_WARN("no sink named %.*s", (int)sink_length, sink_name);
+			return false;
+		}
+		sink->level = level;
+		return true;
+	}
+
+	if (length == 5 && memcmp(name, "drops", 5) == 0) {
+		for (struct log_site const* site = __log_sites_start; site < __log_sites_end; ++site) {
+			if (site->rate.dropped_total > 0) {
+				LOG_INFO("%s:%u: %u dropped", site->file, site->line, site->rate.dropped_total);
+			}
+		}
+		struct log_stats const current = log_get_stats();
+		LOG_INFO("%lu rate limited, %lu repeats folded, %lu lost to full buffers", current.rate_limited, current.repeated, current.buffer_full);
+		return true;
+	}
+
+	if (length == 4 && memcmp(name, "dump", 4) == 0) {
+		log_ring_dump();
+		return true;
+	}
+
+	LOG_WARN("unknown log control command %.*s", (int)length, name);
+	return false;
+}
+
+static struct {
+	char buffer[64];
+	usize length;
+} control_input = { 0 };
+
+void log_control_poll(void) {
+	while (uart_can_recv()) {
+		char const ch = (char)uart_recv();
+		if (ch == '\r' || ch == '\n') {
+			if (control_input.length > 0) {
+				control_input.buffer[control_input.length] = '\0';
+				control_input.length = 0;
+				log_control_command(control_input.buffer);
+			}
+		} else if (control_input.length < sizeof(control_input.buffer) - 1) {
+			control_input.buffer[control_input.length++] = ch;
+		}
+	}
+}
+
+
+enum : u8 {
+	// Marks the start of a record so the decoder can resynchronize with any plain text around it.
+	TOKEN_RECORD_START = 0x1e,
+	TOKEN_CLOCK_START = 0x1d,
+
+	TOKEN_DYNAMIC_SITE = 0,
+
+	TOKEN_FLAG_CORE_ID = 1 << 0,
+
+	// How many records to send between clock records.
+	TOKEN_CLOCK_INTERVAL = 64,
+};
+
+// `length` keeps counting past `capacity` so that overflow can be detected afterwards.
+struct buffer {
+	u8* data;
+	usize capacity;
+	usize length;
+};
+
+static void buffer_byte(struct buffer* const buffer, u8 const byte) {
+	if (buffer->length < buffer->capacity) {
+		buffer->data[buffer->length] = byte;
+	}
+	++buffer->length;
+}
+
+static void buffer_write_callback(void* const buffer, char const ch) {
+	buffer_byte(buffer, (u8)ch);
+}
+
+static void buffer_bytes(struct buffer* const buffer, u8 const* const data, usize const length) {
+	for (usize i = 0; i < length; ++i) {
+		buffer_byte(buffer, data[i]);
+	}
+}
+
+static bool buffer_overflowed(struct buffer const* const buffer) {
+	return buffer->length > buffer->capacity;
+}
+
+static void token_varint(struct buffer* const buffer, u64 value) {
+	while (value >= 0x80) {
+		buffer_byte(buffer, (u8)(value | 0x80));
+		value >>= 7;
+	}
+	buffer_byte(buffer, (u8)value);
+}
+
+static void token_signed(struct buffer* const buffer, i64 const value) {
+	token_varint(buffer, ((u64)value << 1) ^ (u64)(value >> 63));
+}
+
+static void token_bytes(struct buffer* const buffer, u8 const* const data, usize const length) {
+	token_varint(buffer, length);
+	buffer_bytes(buffer, data, length);
+}
+
+static void token_string(struct buffer* const buffer, char const* str) {
+	if (str == NULL) {
+		str = "(null)";
+	}
+	token_bytes(buffer, (u8 const*)str, strlen(str));
+}
+
+// This mirrors the argument consumption of `vdprintf` without doing any formatting.
+// The decoder reports invalid specifiers, so we simply stop sending arguments when we find one.
+static void token_args(struct buffer* const buffer, char const* fmt, __builtin_va_list args) {
+	while (*fmt != '\0') {
+		if (*fmt++ != '%') {
+			continue;
+		}
+
+		while (*fmt == '#' || *fmt == '0' || *fmt == '-' || *fmt == ' ' || *fmt == '+') {
+			++fmt;
+		}
+
+		if (*fmt == '*') {
+			token_signed(buffer, __builtin_va_arg(args, int));
+			++fmt;
+		}
+		while (isdigit(*fmt)) {
+			++fmt;
+		}
+
+		if (*fmt == '.') {
+			++fmt;
+			if (*fmt == '*') {
+				token_signed(buffer, __builtin_va_arg(args, int));
+				++fmt;
+			}
+			while (isdigit(*fmt)) {
+				++fmt;
+			}
+		}
+
+		enum {
+			length_h,
+			length_default,
+			length_l,
+		} length
+			= length_default;
+		switch (*fmt) {
+			case 'h':
+				length = length_h;
+				++fmt;
+				if (*fmt == 'h') {
+					++fmt;
+				}
+				break;
+			case 'l':
+				length = length_l;
+				++fmt;
+				if (*fmt == 'l') {
+					++fmt;
+				}
+				break;
+			case 'q':
+			case 'L':
+			case 'j':
+			case 'z':
+			case 'Z':
+			case 't':
+				length = length_l;
+				++fmt;
+				break;
+		}
+
+		if (*fmt == '@') {
+			++fmt;
+			switch (*fmt) {
+				case 'd': {
+					u8 const* const data = __builtin_va_arg(args, u8 const*);
+					usize const data_length = __builtin_va_arg(args, usize);
+					token_bytes(buffer, data, data_length);
+				} break;
+				case 'b':
+					token_varint(buffer, (bool)__builtin_va_arg(args, int));
+					break;
+				default:
+					return;
+			}
+			++fmt;
+			continue;
+		}
+
+		switch (*fmt) {
+			case 'd':
+			case 'i':
+				// Narrower types are sign-extended to `int` by the default argument promotions, so the decoder can truncate as necessary.
+				token_signed(buffer, length == length_l ? __builtin_va_arg(args, i64) : __builtin_va_arg(args, i32));
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+			case 'b':
+			case 'B':
+				token_varint(buffer, length == length_l ? __builtin_va_arg(args, u64) : __builtin_va_arg(args, u32));
+				break;
+			case 'p':
+				token_varint(buffer, (u64)(usize)__builtin_va_arg(args, void const*));
+				break;
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G': {
+				union {
+					f64 value;
+					u8 bytes[8];
+				} const value = { .value = __builtin_va_arg(args, f64) };
+				buffer_bytes(buffer, value.bytes, sizeof(value.bytes));
+			} break;
+			case 'c':
+				buffer_byte(buffer, (u8)__builtin_va_arg(args, int));
+				break;
+			case 's':
+				token_string(buffer, __builtin_va_arg(args, char const*));
+				break;
+			case 'n':
+				(void)__builtin_va_arg(args, void*);
+				break;
+			case '%':
+				break;
+			default:
+				return;
+		}
+		++fmt;
+	}
+}
+
+// Everything after the site ID, delta, and core: the dynamic site description, if any, and then the arguments.
+static void token_body(struct buffer* const buffer, struct log_record const* const record, char const* const fmt, __builtin_va_list args) {
+	if (record->site_id == TOKEN_DYNAMIC_SITE) {
+		token_string(buffer, record->file);
+		token_varint(buffer, record->line);
+		token_varint(buffer, record->level);
+		token_string(buffer, fmt);
+	}
+	token_args(buffer, fmt, args);
+}
+
+static void format_text(struct buffer* const buffer, struct log_record* const record, char const* const fmt, __builtin_va_list args) {
+	u64 const micros = timer_ticks_to_micros(record->ticks);
+	dprintf(buffer_write_callback, buffer, "[%5lu.%06lu ", micros / 1'000'000, micros % 1'000'000);
+#if LOG_CORE_ID
+	dprintf(buffer_write_callback, buffer, "c%u ", record->core);
+#endif
+	dprintf(buffer_write_callback, buffer, "%s %s:%u] ", CLAMPED_GET(LEVELS, (record->level - 1) / 10), record->file, record->line);
+	record->message_offset = buffer->length;
+	vdprintf(buffer_write_callback, buffer, fmt, args);
+
+	if (buffer_overflowed(buffer)) {
+		buffer->length = buffer->capacity;
+		memcpy(&buffer->data[buffer->length - 3], "...", 3);
+	}
+	record->message_offset = record->message_offset < buffer->length ? record->message_offset : buffer->length;
+}
+
+// # Sinks
+
+void log_sink_add(struct log_sink* const sink) {
+	for (struct log_sink const* existing = sinks; existing != NULL; existing = existing->next) {
+		if (existing == sink) {
+			return;
+		}
+	}
+	sink->next = sinks;
+	sinks = sink;
+}
+
+struct log_sink* log_sink_find(char const* const name, usize const name_length) {
+	for (struct log_sink* sink = sinks; sink != NULL; sink = sink->next) {
+		if (strlen(sink->name) == name_length && memcmp(sink->name, name, name_length) == 0) {
+			return sink;
+		}
+	}
+	return NULL;
+}
+
+static char const* const COLORS[] = { "0;37", "0", "1;30", "1;33", "1;31", "41m\e[1;97" };
+
+static struct {
+	u64 last_ticks;
+	u8 records_until_clock;
+	u8 _pad0[7];
+} uart_token_state = { 0 };
+
+static void uart_send_buffer(struct buffer const* const buffer) {
+	for (usize i = 0; i < buffer->length; ++i) {
+		uart_send((char)buffer->data[i]);
+	}
+}
+
+// The clock and record header are written here rather than in the shared encoding so that the deltas are relative to what this sink actually sent.
+static void uart_write_tokens(struct log_record const* const record) {
+	u8 header_data[64];
+	struct buffer header = { .data = header_data, .capacity = sizeof(header_data), .length = 0 };
+
+	if (uart_token_state.records_until_clock == 0) {
+		buffer_byte(&header, TOKEN_CLOCK_START);
+		token_varint(&header, timer_ticks_per_second());
+		token_varint(&header, record->ticks);
+		token_varint(&header, LOG_CORE_ID ? TOKEN_FLAG_CORE_ID : 0);
+		uart_token_state.last_ticks = record->ticks;
+		uart_token_state.records_until_clock = TOKEN_CLOCK_INTERVAL;
+	}
+	--uart_token_state.records_until_clock;
+
+	// If the arguments didn't fit, send the formatted message (which is truncated instead) as a dynamic record.
+	bool const fallback = record->tokens == NULL;
+
+	buffer_byte(&header, TOKEN_RECORD_START);
+	token_varint(&header, fallback ? TOKEN_DYNAMIC_SITE : record->site_id);
+	token_varint(&header, record->ticks - uart_token_state.last_ticks);
+	uart_token_state.last_ticks = record->ticks;
+#if LOG_CORE_ID
+	buffer_byte(&header, record->core);
+#endif
+	uart_send_buffer(&header);
+
+	if (fallback) {
+		header.length = 0;
+		token_string(&header, record->file);
+		token_varint(&header, record->line);
+		token_varint(&header, record->level);
+		token_string(&header, "%s");
+		token_varint(&header, record->text_length - record->message_offset);
+		uart_send_buffer(&header);
+		uart_send_buffer(&(struct buffer){ .data = (u8*)&record->text[record->message_offset], .length = record->text_length - record->message_offset });
+	} else {
+		uart_send_buffer(&(struct buffer){ .data = (u8*)record->tokens, .length = record->tokens_length });
+	}
+}
+
+static void uart_write(struct log_sink* const sink, struct log_record const* const record) {
+	if (sink->tokens) {
+		uart_write_tokens(record);
+		return;
+	}
+
+	uart_send_str("\e[");
+	uart_send_str(CLAMPED_GET(COLORS, (record->level - 1) / 10));
+	uart_send('m');
+	uart_send_buffer(&(struct buffer){ .data = (u8*)record->text, .length = record->text_length });
+	uart_send_str("\e[0m\r\n");
+}
+
+struct log_sink log_sink_uart = {
+	.name = "uart",
+	.write = uart_write,
+	.next = &log_sink_ring,
+	.level = LOG_LEVEL_TRACE,
+	.tokens = LOG_TOKENIZED,
+};
+
+static struct {
+	char data[LOG_RING_SIZE];
+	// The total number of bytes ever written; the oldest byte still present is at `max(0, written - LOG_RING_SIZE)`.
+	u64 written;
+} ring = { 0 };
+
+static void ring_put(char const* const data, usize const length) {
+	for (usize i = 0; i < length; ++i) {
+		ring.data[(ring.written + i) % LOG_RING_SIZE] = data[i];
+	}
+	ring.written += length;
+}
+
+static void ring_write(struct log_sink* const sink, struct log_record const* const record) {
+	(void)sink;
+	ring_put(record->text, record->text_length);
+	ring_put("\n", 1);
+}
+
+struct log_sink log_sink_ring = {
+	.name = "ring",
+	.write = ring_write,
+	.next = NULL,
+	.level = LOG_LEVEL_TRACE,
+	.tokens = false,
+};
+
+usize log_ring_read(char* const out, usize const capacity) {
+	u64 const available = ring.written < LOG_RING_SIZE ? ring.written : LOG_RING_SIZE;
+	usize const length = (usize)(available < capacity ? available : capacity);
+	// Keep the newest data if `out` is too small.
+	u64 const start = ring.written - length;
+	for (usize i = 0; i < length; ++i) {
+		out[i] = ring.data[(start + i) % LOG_RING_SIZE];
+	}
+	return length;
+}
+
+void log_ring_dump(void) {
+	u64 const available = ring.written < LOG_RING_SIZE ? ring.written : LOG_RING_SIZE;
+	for (u64 i = ring.written - available; i < ring.written; ++i) {
+		char const ch = ring.data[i % LOG_RING_SIZE];
+		if (ch == '\n') {
+			uart_send('\r');
+		}
+		uart_send(ch);
+	}
+}
+
+// 0xRRGGBBAA, matching the UART colors as closely as is reasonable.
+static framebuffer_color_t const CONSOLE_COLORS[] = { 0x8080'80ff, 0xc0c0'c0ff, 0xffff'ffff, 0xffff'00ff, 0xff40'40ff, 0xff00'00ff };
+
+static void console_sink_write(struct log_sink* const sink, struct log_record const* const record) {
+	(void)sink;
+	framebuffer_color_t const color = CLAMPED_GET(CONSOLE_COLORS, (record->level - 1) / 10);
+	console_write(record->text, record->text_length, color);
+	console_write("\n", 1, color);
+}
+
+// Not registered by default because drawing is slow and the framebuffer is not always initialized.
+struct log_sink log_sink_console = {
+	.name = "console",
+	.write = console_sink_write,
+	.next = NULL,
+	.level = LOG_LEVEL_INFO,
+	.tokens = false,
+};
+
+// # Flood Protection
+//
+// Each call site has a token bucket (see `LOG_RATE_PER_SECOND`), checked before anything is formatted.
+// When a site is let through again after dropping records, a warning with the number of dropped records is written first.
+// The buckets are updated without synchronization, so with several cores logging from the same site the limit is approximate.
+//
+// Separately, a record whose site and message are identical to the previous one is not written; instead, a "last message repeated" record is written once a different record arrives.
+// While the repetition continues, the summary is also written every `REPEAT_SUMMARY_INTERVAL_SECONDS` so the count doesn't go unreported indefinitely.
+
+enum : u64 {
+	REPEAT_SUMMARY_INTERVAL_SECONDS = 5,
+};
+
+static struct log_stats stats = { 0 };
+
+// `log_write` has no site, so all dynamic records share a bucket.
+static struct log_rate dynamic_rate = { 0 };
+
+// Only accessed while draining, so only one core at a time.
+static struct {
+	u64 hash;
+	u64 first_ticks;
+	char const* file;
+	u32 line;
+	u32 level;
+	u32 count;
+	u8 _pad0[4];
+} repeat = { 0 };
+
+struct log_stats log_get_stats(void) {
+	return (struct log_stats){
+		.rate_limited = __atomic_load_n(&stats.rate_limited, __ATOMIC_RELAXED),
+		.repeated = __atomic_load_n(&stats.repeated, __ATOMIC_RELAXED),
+		.buffer_full = __atomic_load_n(&stats.buffer_full, __ATOMIC_RELAXED),
+	};
+}
+
+// The credit is measured in timer ticks: each record costs the ticks per record at the configured rate, and the credit grows by one per tick up to a burst's worth.
+static bool rate_allow(struct log_rate* const rate, u32 const level, u64 const ticks) {
+	if (level >= LOG_LEVEL_FATAL) {
+		return true;
+	}
+
+	u64 const cost = timer_ticks_per_second() / LOG_RATE_PER_SECOND;
+	u64 const capacity = cost * LOG_RATE_BURST;
+	// Unused sites start with a full bucket.
+	u64 const elapsed = rate->last_ticks == 0 ? capacity : ticks - rate->last_ticks;
+	rate->last_ticks = ticks;
+	rate->credit = elapsed >= capacity - rate->credit ? capacity : rate->credit + elapsed;
+
+	if (rate->credit < cost) {
+		++rate->dropped;
+		++rate->dropped_total;
+		__atomic_fetch_add(&stats.rate_limited, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	rate->credit -= cost;
+	return true;
+}
+
+static u64 hash_bytes(u64 hash, void const* const data, usize const length) {
+	// FNV-1a.
+	for (usize i = 0; i < length; ++i) {
+		hash = (hash ^ ((u8 const*)data)[i]) * 0x0000'0100'0000'01b3;
+	}
+	return hash;
+}
+
+static u64 record_hash(struct log_record const* const record) {
+	u64 hash = 0xcbf2'9ce4'8422'2325;
+	hash = hash_bytes(hash, &record->site_id, sizeof(record->site_id));
+	hash = hash_bytes(hash, &record->file, sizeof(record->file));
+	hash = hash_bytes(hash, &record->line, sizeof(record->line));
+	hash = hash_bytes(hash, &record->level, sizeof(record->level));
+	if (record->text != NULL) {
+		hash = hash_bytes(hash, &record->text[record->message_offset], record->text_length - record->message_offset);
+	} else {
+		hash = hash_bytes(hash, record->tokens, record->tokens_length);
+	}
+	return hash;
+}
+
+// # Formatting
+
+// These are on the stack because formatting can log recursively, e.g. for invalid format specifiers.
+struct record_buffers {
+	u8 tokens[LOG_RECORD_MAX];
+	char text[LOG_RECORD_MAX];
+};
+
+// Produces the text and tokens, as needed by the sinks that will accept the record.
+// Returns false if there are no such sinks.
+static bool format_record(struct log_record* const record, struct record_buffers* const buffers, char const* const fmt, __builtin_va_list args) {
+	bool want_text = false;
+	bool want_tokens = false;
+	for (struct log_sink const* sink = sinks; sink != NULL; sink = sink->next) {
+		if (record->level >= sink->level) {
+			want_tokens |= sink->tokens;
+			want_text |= !sink->tokens;
+		}
+	}
+	if (!want_text && !want_tokens) {
+		return false;
+	}
+
+	if (want_tokens) {
+		struct buffer tokens = { .data = buffers->tokens, .capacity = sizeof(buffers->tokens), .length = 0 };
+		__builtin_va_list token_args_copy;
+		__builtin_va_copy(token_args_copy, args);
+		token_body(&tokens, record, fmt, token_args_copy);
+		__builtin_va_end(token_args_copy);
+		if (buffer_overflowed(&tokens)) {
+			// Token sinks fall back to the text, which is truncated rather than dropped.
+			want_text = true;
+		} else {
+			record->tokens = buffers->tokens;
+			record->tokens_length = tokens.length;
+		}
+	}
+
+	if (want_text) {
+		struct buffer text = { .data = (u8*)buffers->text, .capacity = sizeof(buffers->text), .length = 0 };
+		format_text(&text, record, fmt, args);
+		record->text = buffers->text;
+		record->text_length = text.length;
+	}
+
+	return true;
+}
+
+static void write_sinks(struct log_record const* const record) {
+	for (struct log_sink* sink = sinks; sink != NULL; sink = sink->next) {
+		if (record->level >= sink->level) {
+			sink->write(sink, record);
+		}
+	}
+}
+
+// Bypasses the per-core buffers, so only call this while draining.
+static void write_direct(char const* const file, u32 const line, u32 const level, char const* const fmt, ...) {
+	struct log_record record = {
+		.ticks = timer_get_ticks(),
+		.file = file,
+		.line = line,
+		.level = level,
+		.core = current_core(),
+		.site_id = TOKEN_DYNAMIC_SITE,
+	};
+	struct record_buffers buffers;
 
 	__builtin_va_list args;
 	__builtin_va_start(args, fmt);
-	uart_vprintf(fmt, args);
+	bool const any = format_record(&record, &buffers, fmt, args);
 	__builtin_va_end(args);
 
-	uart_send_str("\e[0m\r\n");
+	if (any) {
+		write_sinks(&record);
+	}
+}
+
+static void flush_repeats(void) {
+	if (repeat.count == 0) {
+		return;
+	}
+	u32 const count = repeat.count;
+	repeat.count = 0;
+	write_direct(repeat.file, repeat.line, repeat.level, "last message repeated %u times", count);
+}
+
+// Returns whether the record should be written.
+static bool fold_repeats(struct log_record const* const record) {
+	u64 const hash = record_hash(record);
+	if (hash == repeat.hash) {
+		if (repeat.count == 0) {
+			repeat.first_ticks = record->ticks;
+		}
+		++repeat.count;
+		__atomic_fetch_add(&stats.repeated, 1, __ATOMIC_RELAXED);
+		if (record->ticks - repeat.first_ticks >= REPEAT_SUMMARY_INTERVAL_SECONDS * timer_ticks_per_second()) {
+			flush_repeats();
+		}
+		return false;
+	}
+
+	flush_repeats();
+	repeat.hash = hash;
+	repeat.file = record->file;
+	repeat.line = record->line;
+	repeat.level = record->level;
+	return true;
+}
+
+// # Per-Core Buffers
+//
+// Records are formatted on the core that writes them and appended to that core's buffer.
+// Only that core writes to the buffer, so appending needs no lock; interrupts are masked meanwhile so that a handler on the same core can't interleave with a half-written entry.
+// Whichever core manages to take the `draining` flag then moves the records from all buffers to the sinks, oldest first.
+// Lines are therefore never torn, and cores only wait for the sinks when they are the one draining.
+//
+// Each entry is a `struct queued_record` followed by the text and then the tokens, padded to a multiple of 8 bytes.
+// The buffer positions only ever increase; they are reduced modulo the buffer size when accessing the data, so entries can wrap around the end.
+
+struct queued_record {
+	u64 ticks;
+	char const* file;
+	u64 site_id;
+	u32 line;
+	u32 level;
+	u32 text_length;
+	u32 message_offset;
+	u32 tokens_length;
+	u8 core;
+	bool has_text;
+	bool has_tokens;
+	u8 _pad0;
+};
+
+static struct core_buffer {
+	u8 data[LOG_CORE_BUFFER_SIZE];
+	// Written only by the owning core.
+	u64 head;
+	// Written only while draining.
+	u64 tail;
+} core_buffers[LOG_CORE_COUNT] = { 0 };
+
+static bool draining = false;
+
+static usize queued_size(struct queued_record const* const header) {
+	usize const size = sizeof(*header) + (header->has_text ? header->text_length : 0) + (header->has_tokens ? header->tokens_length : 0);
+	return (size + 7) & ~(usize)7;
+}
+
+static void core_buffer_put(struct core_buffer* const buffer, u64 const position, void const* const data, usize const length) {
+	for (usize i = 0; i < length; ++i) {
+		buffer->data[(position + i) % LOG_CORE_BUFFER_SIZE] = ((u8 const*)data)[i];
+	}
+}
+
+static void core_buffer_get(struct core_buffer const* const buffer, u64 const position, void* const data, usize const length) {
+	for (usize i = 0; i < length; ++i) {
+		((u8*)data)[i] = buffer->data[(position + i) % LOG_CORE_BUFFER_SIZE];
+	}
+}
+
+// Returns false if there is not enough space.
+static bool enqueue(struct log_record const* const record) {
+	struct queued_record const header = {
+		.ticks = record->ticks,
+		.file = record->file,
+		.site_id = record->site_id,
+		.line = record->line,
+		.level = record->level,
+		.text_length = (u32)record->text_length,
+		.message_offset = (u32)record->message_offset,
+		.tokens_length = (u32)record->tokens_length,
+		.core = record->core,
+		.has_text = record->text != NULL,
+		.has_tokens = record->tokens != NULL,
+	};
+	usize const size = queued_size(&header);
+
+	bool ok = false;
+	WITHOUT_INTERRUPTS({
+		struct core_buffer* const buffer = &core_buffers[record->core % LOG_CORE_COUNT];
+		u64 const head = buffer->head;
+		if (head + size - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) <= LOG_CORE_BUFFER_SIZE) {
+			core_buffer_put(buffer, head, &header, sizeof(header));
+			u64 position = head + sizeof(header);
+			if (header.has_text) {
+				core_buffer_put(buffer, position, record->text, header.text_length);
+				position += header.text_length;
+			}
+			if (header.has_tokens) {
+				core_buffer_put(buffer, position, record->tokens, header.tokens_length);
+			}
+			// Sequentially consistent so that it is ordered before our check of `draining`; see `drain`.
+			__atomic_store_n(&buffer->head, head + size, __ATOMIC_SEQ_CST);
+			ok = true;
+		}
+	})
+	return ok;
+}
+
+static bool any_queued(void) {
+	for (usize i = 0; i < LOG_CORE_COUNT; ++i) {
+		if (__atomic_load_n(&core_buffers[i].head, __ATOMIC_SEQ_CST) != core_buffers[i].tail) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Writes out the oldest queued record, if any, and returns whether there was one.
+static bool drain_one(void) {
+	struct core_buffer* oldest = NULL;
+	struct queued_record header;
+	for (usize i = 0; i < LOG_CORE_COUNT; ++i) {
+		struct core_buffer* const buffer = &core_buffers[i];
+		if (__atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE) == buffer->tail) {
+			continue;
+		}
+		struct queued_record candidate;
+		core_buffer_get(buffer, buffer->tail, &candidate, sizeof(candidate));
+		if (oldest == NULL || candidate.ticks < header.ticks) {
+			oldest = buffer;
+			header = candidate;
+		}
+	}
+	if (oldest == NULL) {
+		return false;
+	}
+
+	struct record_buffers buffers;
+	struct log_record record = {
+		.ticks = header.ticks,
+		.file = header.file,
+		.line = header.line,
+		.level = header.level,
+		.core = header.core,
+		.site_id = header.site_id,
+	};
+	u64 position = oldest->tail + sizeof(header);
+	if (header.has_text) {
+		core_buffer_get(oldest, position, buffers.text, header.text_length);
+		position += header.text_length;
+		record.text = buffers.text;
+		record.text_length = header.text_length;
+		record.message_offset = header.message_offset;
+	}
+	if (header.has_tokens) {
+		core_buffer_get(oldest, position, buffers.tokens, header.tokens_length);
+		record.tokens = buffers.tokens;
+		record.tokens_length = header.tokens_length;
+	}
+	// The entry has been copied out, so the owning core can reuse the space while we write.
+	__atomic_store_n(&oldest->tail, oldest->tail + queued_size(&header), __ATOMIC_RELEASE);
+
+	if (fold_repeats(&record)) {
+		write_sinks(&record);
+	}
+	return true;
+}
+
+// Returns immediately if another core (or an interrupted context on this one) is already draining; it will pick up our records too.
+// After releasing the flag, we check again in case a record was appended after we last looked, since its writer would have seen the flag still taken.
+static void drain(void) {
+	do {
+		if (__atomic_exchange_n(&draining, true, __ATOMIC_SEQ_CST)) {
+			return;
+		}
+		while (drain_one()) {}
+		__atomic_store_n(&draining, false, __ATOMIC_SEQ_CST);
+	} while (any_queued());
+}
+
+// # Writing
+
+static void submit(struct log_record* const record, char const* const fmt, __builtin_va_list args) {
+	struct record_buffers buffers;
+	if (!format_record(record, &buffers, fmt, args)) {
+		return;
+	}
+
+	if (!enqueue(record)) {
+		// Make space if we can, but never wait for another core.
+		drain();
+		if (!enqueue(record)) {
+			__atomic_fetch_add(&stats.buffer_full, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	drain();
+}
+
+static void write_unlimited_v(char const* const file, u32 const line, u32 const level, u64 const ticks, char const* const fmt, __builtin_va_list args) {
+	struct log_record record = {
+		.ticks = ticks,
+		.file = file,
+		.line = line,
+		.level = level,
+		.core = current_core(),
+		.site_id = TOKEN_DYNAMIC_SITE,
+	};
+	submit(&record, fmt, args);
+}
+
+static void write_unlimited(char const* const file, u32 const line, u32 const level, char const* const fmt, ...) {
+	__builtin_va_list args;
+	__builtin_va_start(args, fmt);
+	write_unlimited_v(file, line, level, timer_get_ticks(), fmt, args);
+	__builtin_va_end(args);
+}
+
+static void write_dropped(struct log_rate* const rate, char const* const file, u32 const line) {
+	if (rate->dropped == 0) {
+		return;
+	}
+	u32 const dropped = rate->dropped;
+	rate->dropped = 0;
+	write_unlimited(file, line, LOG_LEVEL_WARN, "rate limit dropped %u records from this site", dropped);
+}
+
+void log_write_site(struct log_site* const site, ...) {
+	struct log_record record = {
+		.ticks = timer_get_ticks(),
+		.file = site->file,
+		.line = site->line,
+		.level = site->level,
+		.core = current_core(),
+		.site_id = (u64)(site - __log_sites_start) + 1,
+	};
+
+	if (!rate_allow(&site->rate, site->level, record.ticks)) {
+		return;
+	}
+	write_dropped(&site->rate, site->file, site->line);
+
+	__builtin_va_list args;
+	__builtin_va_start(args, site);
+	submit(&record, site->fmt, args);
+	__builtin_va_end(args);
+}
+
+void log_write(char const* const file, u32 const line, u32 const level, char const* const fmt, ...) {
+	u64 const ticks = timer_get_ticks();
+	if (!rate_allow(&dynamic_rate, level, ticks)) {
+		return;
+	}
+	write_dropped(&dynamic_rate, file, line);
+
+	__builtin_va_list args;
+	__builtin_va_start(args, fmt);
+	write_unlimited_v(file, line, level, ticks, fmt, args);
+	__builtin_va_end(args);
 }
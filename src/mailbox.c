@@ -105,3 +105,18 @@ bool mailbox_set_clock_rate(mailbox_clock_t const clock, u32 const rate) {
 
 	return mailbox_call(mailbox_channel_tags);
 }
+
+bool mailbox_set_gpio_state(u32 const gpio, bool const state) {
+	LOG_DEBUG("setting firmware GPIO %u to %u", gpio, state);
+
+	mailbox[0] = 8 * sizeof(u32);
+	mailbox[1] = MAILBOX_REQUEST;
+	mailbox[2] = MAILBOX_TAG_SET_GPIO_STATE;
+	mailbox[3] = 2 * sizeof(u32);
+	mailbox[4] = 0;
+	mailbox[5] = gpio;
+	mailbox[6] = state;
+	mailbox[7] = MAILBOX_TAG_LAST;
+
+	return mailbox_call(mailbox_channel_tags);
+}
@@ -39,6 +39,29 @@ void sleep_micros(u64 const micros) {
 	}
 }
 
+bool sleep_until_flag(u32 const volatile* const flags, u32 const mask, u64 const end) {
+	if (exception_get_mask() & exception_mask_irq) {
+		while (!(*flags & mask) && timer_get_micros() < end) {
+			asm volatile("isb");
+		}
+		return *flags & mask;
+	}
+
+	timer_set_compare(SLEEP_TIMER, (u32)end);
+	while (true) {
+		// We check with IRQs masked so that an interrupt arriving between the check and the `wfi` isn't missed.
+		// A pending interrupt still ends `wfi` while masked, and it is taken as soon as we unmask.
+		asm volatile("msr daifset, #0b0010");
+		bool const set = *flags & mask;
+		if (set || timer_get_micros() >= end) {
+			asm volatile("msr daifclr, #0b0010");
+			return set;
+		}
+		asm volatile("wfi");
+		asm volatile("msr daifclr, #0b0010");
+	}
+}
+
 void sleep_until(u64 const end) {
 	if (timer_get_micros() >= end) {
 		return;
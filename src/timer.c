@@ -25,3 +25,13 @@ u64 timer_get_micros(void) {
 void timer_set_compare(u8 const timer, u32 const end_micros) {
 	TIMER_BASE->compare[timer] = end_micros;
 }
+
+// Emit external definitions in case the calls are not inlined.
+extern inline u64 timer_get_ticks(void);
+extern inline u64 timer_ticks_per_second(void);
+
+u64 timer_ticks_to_micros(u64 const ticks) {
+	u64 const frequency = timer_ticks_per_second();
+	// Split the conversion so that `ticks * 1'000'000` can't overflow.
+	return ticks / frequency * 1'000'000 + ticks % frequency * 1'000'000 / frequency;
+}
@@ -0,0 +1,310 @@
+// # Approach
+//
+// SD cards manage their flash in allocation units, and a write that covers only part of one makes the card copy the rest of the unit internally, which can stall it for milliseconds.
+// So, writes are copied into a buffer for the unit that they fall in, and the unit is written out with a single aligned multi-block write once every block of it has been written.
+// Writes that cover whole units are passed straight through, since they are already what the card wants.
+//
+// A unit that has to be written out before it is full, because another unit needs its buffer or because of a flush, is completed by reading the missing blocks first, as long as at least half of it has been written.
+// Below that, reading and rewriting the whole unit costs more than the card's own copy, so only the written runs are passed on.
+
+#include "block_device.h"
+#include "log.h"
+#include "malloc.h"
+#include "string.h"
+#include "try.h"
+#include "write_stage.h"
+
+enum : u32 {
+	NONE = U32_MAX,
+	BITMAP_WORDS = WRITE_STAGE_MAX_BLOCKS / 64,
+};
+
+struct unit {
+	u8* data;
+	// The first block, or `NONE` if the buffer is free.
+	u32 block;
+	// The number of bits set in `bitmap`.
+	u32 written;
+	// The value of `stage.uses` when the unit was last written to, for picking which one to write out.
+	u64 last_use;
+	// Which blocks have been written.
+	u64 bitmap[BITMAP_WORDS];
+};
+
+static struct {
+	struct block_device* backing;
+	u32 unit_blocks;
+	u8 _pad0[4];
+	u64 uses;
+	struct unit units[WRITE_STAGE_UNITS];
+	struct write_stage_stats stats;
+} stage;
+
+static u8* unit_block(struct unit const* const unit, u32 const offset) {
+	return &unit->data[(usize)offset * BLOCK_DEVICE_BLOCK_SIZE];
+}
+
+static bool is_written(struct unit const* const unit, u32 const offset) {
+	return (unit->bitmap[offset / 64] >> (offset % 64)) & 1;
+}
+
+static void mark_written(struct unit* const unit, u32 const offset) {
+	if (!is_written(unit, offset)) {
+		unit->bitmap[offset / 64] |= 1ull << (offset % 64);
+		++unit->written;
+	}
+}
+
+// The length of the run starting at `offset` of blocks that are all written or all unwritten.
+static u32 run_length(struct unit const* const unit, u32 const offset) {
+	bool const written = is_written(unit, offset);
+	u32 end = offset + 1;
+	while (end < stage.unit_blocks && is_written(unit, end) == written) {
+		++end;
+	}
+	return end - offset;
+}
+
+static void release(struct unit* const unit) {
+	unit->block = NONE;
+	unit->written = 0;
+	memset(unit->bitmap, 0, sizeof(unit->bitmap));
+}
+
+static bool write_out(struct unit* const unit) {
+	if (unit->block == NONE) {
+		return true;
+	}
+
+	if (unit->written * 2 < stage.unit_blocks) {
+		for (u32 offset = 0; offset < stage.unit_blocks;) {
+			u32 const length = run_length(unit, offset);
+			if (is_written(unit, offset)) {
+				TRY(block_device_write(stage.backing, unit_block(unit, offset), unit->block + offset, length))
+			}
+			offset += length;
+		}
+		++stage.stats.partial_units;
+		release(unit);
+		return true;
+	}
+
+	if (unit->written < stage.unit_blocks) {
+		for (u32 offset = 0; offset < stage.unit_blocks;) {
+			u32 const length = run_length(unit, offset);
+			if (!is_written(unit, offset)) {
+				TRY(block_device_read(stage.backing, unit_block(unit, offset), unit->block + offset, length))
+				stage.stats.fill_blocks += length;
+			}
+			offset += length;
+		}
+		++stage.stats.filled_units;
+	} else {
+		++stage.stats.full_units;
+	}
+
+	TRY(block_device_write(stage.backing, unit->data, unit->block, stage.unit_blocks))
+	release(unit);
+	return true;
+}
+
+static struct unit* find_unit(u32 const unit_start) {
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		if (stage.units[i].block == unit_start) {
+			return &stage.units[i];
+		}
+	}
+	return NULL;
+}
+
+// Writes out the least recently used unit if none are free.
+static struct unit* take_unit(u32 const unit_start) {
+	struct unit* victim = &stage.units[0];
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		struct unit* const unit = &stage.units[i];
+		if (unit->block == NONE) {
+			victim = unit;
+			break;
+		}
+		if (unit->last_use < victim->last_use) {
+			victim = unit;
+		}
+	}
+
+	if (!write_out(victim)) {
+		return NULL;
+	}
+	victim->block = unit_start;
+	return victim;
+}
+
+bool write_stage_init(struct block_device* const backing) {
+	u32 unit_blocks = block_device_allocation_unit(backing);
+	if (unit_blocks == 0 || unit_blocks > WRITE_STAGE_MAX_BLOCKS) {
+		unit_blocks = WRITE_STAGE_MAX_BLOCKS;
+	}
+
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		stage.units[i].data = malloc((usize)unit_blocks * BLOCK_DEVICE_BLOCK_SIZE);
+		TRY_MSG(stage.units[i].data != NULL)
+		release(&stage.units[i]);
+	}
+
+	stage.backing = backing;
+	stage.unit_blocks = unit_blocks;
+
+	LOG_INFO("staging writes to %s in units of %u blocks", backing->name, unit_blocks);
+	return true;
+}
+
+static bool stage_write(u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	u32 const capacity = block_device_capacity(stage.backing);
+
+	for (u32 done = 0; done < num_blocks;) {
+		u32 const block = block_start + done;
+		u32 const unit_start = block / stage.unit_blocks * stage.unit_blocks;
+		u32 const offset = block - unit_start;
+		u32 const remaining = num_blocks - done;
+		u8 const* const source = buffer != NULL ? &buffer[(usize)done * BLOCK_DEVICE_BLOCK_SIZE] : NULL;
+
+		// Consecutive whole units go out in one write, replacing anything staged for them.
+		if (offset == 0 && remaining >= stage.unit_blocks) {
+			u32 const count = remaining / stage.unit_blocks * stage.unit_blocks;
+			for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+				if (stage.units[i].block != NONE && stage.units[i].block - block < count) {
+					release(&stage.units[i]);
+				}
+			}
+			TRY(block_device_write(stage.backing, source, block, count))
+			stage.stats.direct_units += count / stage.unit_blocks;
+			done += count;
+			continue;
+		}
+
+		u32 const count = stage.unit_blocks - offset < remaining ? stage.unit_blocks - offset : remaining;
+
+		// A unit that runs past the end of the device can never be written whole.
+		if (unit_start + stage.unit_blocks > capacity) {
+			TRY(block_device_write(stage.backing, source, block, count))
+			done += count;
+			continue;
+		}
+
+		struct unit* unit = find_unit(unit_start);
+		if (unit == NULL) {
+			unit = take_unit(unit_start);
+			TRY(unit != NULL)
+		}
+
+		if (source != NULL) {
+			memcpy(unit_block(unit, offset), source, (usize)count * BLOCK_DEVICE_BLOCK_SIZE);
+		} else {
+			memset(unit_block(unit, offset), 0, (usize)count * BLOCK_DEVICE_BLOCK_SIZE);
+		}
+		for (u32 i = 0; i < count; ++i) {
+			mark_written(unit, offset + i);
+		}
+		stage.stats.staged_blocks += count;
+		unit->last_use = ++stage.uses;
+
+		if (unit->written == stage.unit_blocks) {
+			TRY(write_out(unit))
+		}
+		done += count;
+	}
+
+	return true;
+}
+
+static bool stage_read(u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	u32 const unit_start = block_start / stage.unit_blocks * stage.unit_blocks;
+	struct unit const* const single = block_start + num_blocks <= unit_start + stage.unit_blocks ? find_unit(unit_start) : NULL;
+
+	// Reads of blocks that were just written don't need the card at all.
+	bool all_staged = single != NULL;
+	for (u32 i = 0; all_staged && i < num_blocks; ++i) {
+		all_staged = is_written(single, block_start - unit_start + i);
+	}
+	if (!all_staged) {
+		TRY(block_device_read(stage.backing, buffer, block_start, num_blocks))
+	}
+
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		struct unit const* const unit = &stage.units[i];
+		if (unit->block == NONE || unit->block >= block_start + num_blocks || unit->block + stage.unit_blocks <= block_start) {
+			continue;
+		}
+
+		u32 const first = unit->block > block_start ? unit->block : block_start;
+		u32 const end = unit->block + stage.unit_blocks < block_start + num_blocks ? unit->block + stage.unit_blocks : block_start + num_blocks;
+		for (u32 block = first; block < end; ++block) {
+			if (is_written(unit, block - unit->block)) {
+				memcpy(&buffer[(usize)(block - block_start) * BLOCK_DEVICE_BLOCK_SIZE], unit_block(unit, block - unit->block), BLOCK_DEVICE_BLOCK_SIZE);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool write_stage_flush(void) {
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		TRY(write_out(&stage.units[i]))
+	}
+	return true;
+}
+
+struct write_stage_stats write_stage_get_stats(void) {
+	return stage.stats;
+}
+
+static bool device_read(struct block_device* const device, u8* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return stage_read(buffer, block_start, num_blocks);
+}
+
+static bool device_write(struct block_device* const device, u8 const* const buffer, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	return stage_write(buffer, block_start, num_blocks);
+}
+
+static bool device_flush(struct block_device* const device) {
+	(void)device;
+	return write_stage_flush() && block_device_flush(stage.backing);
+}
+
+// The contents of discarded blocks are undefined, so staged copies of them can be kept, except that units that are discarded entirely are dropped.
+static bool device_discard(struct block_device* const device, u32 const block_start, u32 const num_blocks) {
+	(void)device;
+	for (u32 i = 0; i < WRITE_STAGE_UNITS; ++i) {
+		struct unit* const unit = &stage.units[i];
+		if (unit->block != NONE && unit->block >= block_start && unit->block + stage.unit_blocks <= block_start + num_blocks) {
+			release(unit);
+		}
+	}
+	return block_device_discard(stage.backing, block_start, num_blocks);
+}
+
+static u32 device_capacity(struct block_device* const device) {
+	(void)device;
+	return block_device_capacity(stage.backing);
+}
+
+static u32 device_allocation_unit(struct block_device* const device) {
+	(void)device;
+	return block_device_allocation_unit(stage.backing);
+}
+
+static struct block_device_ops const OPS = {
+	.read = device_read,
+	.write = device_write,
+	.flush = device_flush,
+	.discard = device_discard,
+	.capacity = device_capacity,
+	.allocation_unit = device_allocation_unit,
+};
+
+struct block_device write_stage_device = {
+	.ops = &OPS,
+	.name = "stage",
+};
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# Generates `src/font.c` by rasterizing a monospace TrueType font into 8x16 bitmaps.
+#
+# Usage: `tools/gen-font.py /usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf > src/font.c`
+#
+# Requires Pillow.
+
+import sys
+
+from PIL import Image, ImageDraw, ImageFont
+
+WIDTH = 8
+HEIGHT = 16
+FIRST = 0x20
+LAST = 0x7E
+SIZE = 14
+# Moves the glyphs up so that the descenders of `g`, `y`, etc. still fit in the cell.
+OFFSET_Y = -2
+THRESHOLD = 100
+
+
+def glyph_rows(font, ch):
+	image = Image.new("L", (WIDTH, HEIGHT), 0)
+	ImageDraw.Draw(image).text((0, OFFSET_Y), ch, font=font, fill=255)
+	rows = []
+	for y in range(HEIGHT):
+		row = 0
+		for x in range(WIDTH):
+			if image.getpixel((x, y)) > THRESHOLD:
+				row |= 0x80 >> x
+		rows.append(row)
+	return rows
+
+
+def main():
+	if len(sys.argv) != 2:
+		print(f"usage: {sys.argv[0]} <font.ttf>", file=sys.stderr)
+		sys.exit(2)
+
+	font = ImageFont.truetype(sys.argv[1], SIZE)
+
+	print("// Generated by `tools/gen-font.py` from DejaVu Sans Mono. Do not edit by hand.")
+	print("// DejaVu fonts are derived from Bitstream Vera; see <https://dejavu-fonts.github.io/License.html>.")
+	print()
+	print('#include "font.h"')
+	print()
+	print("u8 const FONT_GLYPHS[FONT_GLYPH_COUNT][FONT_HEIGHT] = {")
+	for code in range(FIRST, LAST + 1):
+		ch = chr(code)
+		rows = ", ".join(f"0x{row:02x}" for row in glyph_rows(font, ch))
+		print(f"\t// {ch!r}")
+		print(f"\t{{ {rows} }},")
+	print("};")
+
+
+if __name__ == "__main__":
+	main()
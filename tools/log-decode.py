@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+# Decodes tokenized log output (see `src/log.c`) back into the text that the kernel would have printed.
+#
+# Usage: `tools/log-decode.py target/kernel8.elf [input]`
+#
+# `input` defaults to standard input and can be a serial device, e.g. `/dev/ttyUSB0`.
+# In that case, configure the port first, e.g. with `stty -F /dev/ttyUSB0 115200 raw -echo`.
+# Bytes outside of records are passed through unchanged so plain `uart_printf` output still shows up.
+
+import struct
+import sys
+
+# Keep these in sync with `include/log.h` and `src/log.c`.
+# The trailing fields are the mutable rate limiting state, which we skip.
+LOG_SITE_FORMAT = "<QQII24x"
+LOG_SITE_SIZE = struct.calcsize(LOG_SITE_FORMAT)
+TOKEN_RECORD_START = 0x1E
+TOKEN_CLOCK_START = 0x1D
+TOKEN_DYNAMIC_SITE = 0
+TOKEN_FLAG_CORE_ID = 1 << 0
+
+LEVELS = ["trace", "debug", "info", "warn", "error", "fatal", "???"]
+COLORS = ["0;37", "0", "1;30", "1;33", "1;31", "41m\x1b[1;97"]
+
+
+class DecodeError(Exception):
+	pass
+
+
+class Elf:
+	def __init__(self, path):
+		with open(path, "rb") as file:
+			self.data = file.read()
+		if self.data[:4] != b"\x7fELF" or self.data[4] != 2 or self.data[5] != 1:
+			raise DecodeError(f"{path} is not a little-endian ELF64 file")
+
+		(shoff,) = struct.unpack_from("<Q", self.data, 0x28)
+		shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x3A)
+		headers = [struct.unpack_from("<IIQQQQIIQQ", self.data, shoff + i * shentsize) for i in range(shnum)]
+		names_offset = headers[shstrndx][4]
+
+		self.sections = {}
+		for name_offset, kind, _flags, address, offset, size, *_ in headers:
+			name = self.c_string_at_offset(names_offset + name_offset).decode()
+			# `SHT_NOBITS` sections like `.bss` have no data in the file.
+			self.sections[name] = (address, offset if kind != 8 else None, size)
+
+	def c_string_at_offset(self, offset):
+		end = self.data.index(b"\0", offset)
+		return self.data[offset:end]
+
+	def c_string_at_address(self, address):
+		for section_address, offset, size in self.sections.values():
+			if offset is not None and section_address <= address < section_address + size:
+				return self.c_string_at_offset(offset + address - section_address).decode(errors="replace")
+		raise DecodeError(f"address {address:#x} is not in any section")
+
+	def log_sites(self):
+		if ".log_sites" not in self.sections:
+			raise DecodeError("no .log_sites section; was the kernel built with `LOG_TOKENIZED=1`?")
+		_address, offset, size = self.sections[".log_sites"]
+		sites = []
+		for site_offset in range(offset, offset + size, LOG_SITE_SIZE):
+			file, fmt, line, level = struct.unpack_from(LOG_SITE_FORMAT, self.data, site_offset)
+			sites.append((self.c_string_at_address(file), line, level, self.c_string_at_address(fmt)))
+		return sites
+
+
+class Reader:
+	def __init__(self, stream):
+		self.stream = stream
+
+	def byte(self):
+		byte = self.stream.read(1)
+		if not byte:
+			raise EOFError
+		return byte[0]
+
+	def raw(self, length):
+		data = b""
+		while len(data) < length:
+			chunk = self.stream.read(length - len(data))
+			if not chunk:
+				raise EOFError
+			data += chunk
+		return data
+
+	def varint(self):
+		value = 0
+		shift = 0
+		while True:
+			byte = self.byte()
+			value |= (byte & 0x7F) << shift
+			shift += 7
+			if byte < 0x80:
+				return value
+
+	def signed(self):
+		value = self.varint()
+		return (value >> 1) ^ -(value & 1)
+
+	def bytes(self):
+		return self.raw(self.varint())
+
+	def string(self):
+		return self.bytes().decode(errors="replace")
+
+
+def pad(text, width, flags):
+	if len(text) >= width:
+		return text
+	if "-" in flags:
+		return text.ljust(width)
+	if "0" in flags:
+		sign = text[0] if text[:1] in ("-", "+", " ") else ""
+		return sign + text[len(sign) :].rjust(width - len(sign), "0")
+	return text.rjust(width)
+
+
+def truncate(value, length):
+	bits = {"hh": 8, "h": 16, "": 32}.get(length, 64)
+	return value & ((1 << bits) - 1)
+
+
+# Mirrors `vdprintf` in `src/printf.c`, but reads the arguments from the record.
+def render(fmt, reader):
+	out = []
+	i = 0
+	while i < len(fmt):
+		if fmt[i] != "%":
+			out.append(fmt[i])
+			i += 1
+			continue
+		i += 1
+
+		flags = ""
+		while i < len(fmt) and fmt[i] in "#0- +":
+			flags += fmt[i]
+			i += 1
+
+		width = 0
+		if fmt[i : i + 1] == "*":
+			width = reader.signed()
+			i += 1
+		while i < len(fmt) and fmt[i].isdigit():
+			width = width * 10 + int(fmt[i])
+			i += 1
+
+		precision = None
+		if fmt[i : i + 1] == ".":
+			i += 1
+			precision = 0
+			if fmt[i : i + 1] == "*":
+				precision = reader.signed()
+				i += 1
+			while i < len(fmt) and fmt[i].isdigit():
+				precision = precision * 10 + int(fmt[i])
+				i += 1
+
+		length = ""
+		for candidate in ("hh", "h", "ll", "l", "q", "L", "j", "z", "Z", "t"):
+			if fmt.startswith(candidate, i):
+				length = candidate
+				i += len(candidate)
+				break
+		if length not in ("", "hh", "h"):
+			length = "l"
+
+		if fmt[i : i + 1] == "@":
+			conversion = "@" + fmt[i + 1 : i + 2]
+			i += 2
+		else:
+			conversion = fmt[i : i + 1]
+			i += 1
+
+		python_flags = flags.replace("0", "").replace("-", "")
+		precision_spec = "" if precision is None else f".{precision}"
+
+		if conversion in ("d", "i"):
+			value = reader.signed()
+			if length in ("hh", "h"):
+				bits = 8 if length == "hh" else 16
+				value = (value + (1 << (bits - 1))) % (1 << bits) - (1 << (bits - 1))
+			text = ("%" + python_flags + precision_spec + "d") % value
+		elif conversion == "u":
+			text = ("%" + precision_spec + "d") % truncate(reader.varint(), length)
+		elif conversion in ("x", "X"):
+			text = ("%" + python_flags.replace(" ", "").replace("+", "") + precision_spec + conversion) % truncate(reader.varint(), length)
+		elif conversion == "o":
+			value = truncate(reader.varint(), length)
+			text = ("0" if "#" in flags and value != 0 else "") + format(value, "o")
+		elif conversion in ("b", "B"):
+			value = truncate(reader.varint(), length)
+			text = ("0" + conversion if "#" in flags else "") + format(value, "b")
+		elif conversion == "p":
+			text = f"{reader.varint():#x}"
+		elif conversion in ("e", "E", "f", "F", "g", "G"):
+			(value,) = struct.unpack("<d", reader.raw(8))
+			text = ("%" + python_flags + (precision_spec or ".6") + conversion) % value
+		elif conversion == "c":
+			text = chr(reader.byte())
+		elif conversion == "s":
+			text = reader.string()
+			if precision is not None:
+				text = text[:precision]
+		elif conversion == "n":
+			continue
+		elif conversion == "%":
+			out.append("%")
+			continue
+		elif conversion == "@d":
+			text = reader.bytes().hex()
+		elif conversion == "@b":
+			value = reader.varint() != 0
+			text = ("true" if value else "false") if "#" in flags else ("t" if value else "f")
+		else:
+			raise DecodeError(f"invalid format specifier %{conversion} in {fmt!r}")
+
+		out.append(pad(text, width, flags))
+	return "".join(out)
+
+
+class Clock:
+	def __init__(self):
+		self.frequency = None
+		self.ticks = 0
+		self.flags = 0
+
+	def micros(self, ticks):
+		return ticks * 1_000_000 // self.frequency
+
+
+# Like the kernel's text output, but with the time since the previous record added so the log can be read as a latency trace.
+def format_record(clock, delta, core, file, line, level, message):
+	level_index = max(level - 1, 0) // 10
+	color = COLORS[min(level_index, len(COLORS) - 1)]
+	name = LEVELS[min(level_index, len(LEVELS) - 1)]
+	if clock.frequency is None:
+		time = "?"
+	else:
+		micros = clock.micros(clock.ticks)
+		time = f"{micros // 1_000_000:5}.{micros % 1_000_000:06} +{clock.micros(delta)}us"
+	core = "" if core is None else f"c{core} "
+	return f"\x1b[{color}m[{time} {core}{name} {file}:{line}] {message}\x1b[0m\n"
+
+
+def decode(sites, reader, out):
+	clock = Clock()
+	while True:
+		byte = reader.byte()
+		if byte == TOKEN_CLOCK_START:
+			clock.frequency = reader.varint()
+			clock.ticks = reader.varint()
+			clock.flags = reader.varint()
+			continue
+		if byte != TOKEN_RECORD_START:
+			out.write(chr(byte) if byte != ord("\r") else "")
+			continue
+
+		site_id = reader.varint()
+		delta = reader.varint()
+		clock.ticks += delta
+		core = reader.byte() if clock.flags & TOKEN_FLAG_CORE_ID else None
+		if site_id == TOKEN_DYNAMIC_SITE:
+			file = reader.string()
+			line = reader.varint()
+			level = reader.varint()
+			fmt = reader.string()
+		elif site_id <= len(sites):
+			file, line, level, fmt = sites[site_id - 1]
+		else:
+			out.write(f"\n<unknown log site {site_id}; is the ELF file out of date?>\n")
+			continue
+
+		try:
+			message = render(fmt, reader)
+		except DecodeError as error:
+			message = f"<{error}>"
+		out.write(format_record(clock, delta, core, file, line, level, message))
+		out.flush()
+
+
+def main():
+	if len(sys.argv) not in (2, 3):
+		print(f"usage: {sys.argv[0]} <kernel8.elf> [input]", file=sys.stderr)
+		sys.exit(2)
+
+	sites = Elf(sys.argv[1]).log_sites()
+	stream = open(sys.argv[2], "rb", buffering=0) if len(sys.argv) == 3 else sys.stdin.buffer
+	try:
+		decode(sites, Reader(stream), sys.stdout)
+	except (EOFError, KeyboardInterrupt):
+		pass
+
+
+if __name__ == "__main__":
+	main()